@@ -0,0 +1,265 @@
+/**
+ * @file SDfarea.h
+ * @author Radica
+ * @brief Extensions to the floating point 3-tree (FXYTREE) maintained in
+ *        sdfarea.c. The base types and entry points live in SDarea.h.
+ * @version 0.1
+ * @date 2024-07-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef SDFAREA_H
+#define SDFAREA_H
+
+#include "SDarea.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+        One input record for build_fxytree_bulk(). Same fields as an FXYITEM
+        without the link, so callers can fill a plain array.
+    */
+    typedef struct fxybulkitem
+    {
+        double x1;
+        double y1;
+        double x2;
+        double y2;
+        oslong ud1;
+        oslong ud2;
+    } FXYBULKITEM;
+
+    FXYTREE *build_fxytree_bulk(const FXYBULKITEM *items, int n);
+    void rebalance_fxytree_incremental(FXYTREE **b);
+    void rebalance_fxytree_parallel(FXYTREE **b);
+
+    /*
+        Item memory accounting. unregister_farea() puts the deleted item on a
+        free list that register_farea() draws from, so a tree that sees many
+        registers and unregisters between rebalances stays the same size.
+        fxytree_compact() copies the live items into fresh chunk memory and
+        drops the free list without touching the tree shape; call it in
+        idle time when freeItems is large.
+    */
+    typedef struct fxymemstats
+    {
+        int liveItems; // items registered in the tree
+        int freeItems; // deleted items waiting for reuse
+        int memPages;  // chunk pages held by the tree for items
+        int nodePages; // chunk pages held by the tree for nodes
+        double bytes;  // memory of those pages and any malloc'ed nodes
+    } FXYMEMSTATS;
+
+    void fxytree_mem_stats(const FXYTREE *tl, FXYMEMSTATS *stats);
+    void fxytree_compact(FXYTREE *tl);
+
+    /*
+        Shape of a tree, to spot degenerate ones. A leaf is a non-empty
+        item list. expectedCost is the expected number of nodes plus items
+        a search the size of an average item looks at, assuming searches
+        land uniformly over the tree's bounding box; a well balanced tree
+        keeps it near log(items).
+    */
+    typedef struct fxystats
+    {
+        int nodes;
+        int leaves;
+        int items;
+        int depth;          // deepest node, the root is depth 1
+        int maxLeaf;        // items in the longest leaf
+        double meanLeaf;    // items per leaf
+        int middleItems;    // items in MIDDLE leaves
+        int maxMiddle;      // items in the longest MIDDLE leaf
+        double expectedCost;
+    } FXYSTATS;
+
+    void fxytree_stats(const FXYTREE *tl, FXYSTATS *stats);
+
+    /*
+        Read-only ("frozen") form of an FXYTREE. All nodes live in one array
+        and refer to their children by 32-bit index. A child index with
+        FXYFROZEN_LEAF set refers to a leaf instead of a node, and
+        FXYFROZEN_EMPTY marks an empty branch. The items of every leaf are
+        stored next to each other in one FXYITEM array, so a leaf scan walks
+        memory in order. The copied items keep their boxes and user fields;
+        their next pointers are NULL. The item boxes are also kept as four
+        parallel coordinate arrays (bx1[i] .. by2[i] is the box of items[i])
+        for the vector leaf scan, fxy_overlap_mask().
+    */
+#define FXYFROZEN_LEAF 0x80000000u
+#define FXYFROZEN_EMPTY 0xffffffffu
+
+    typedef struct fxyfrozen_node
+    {
+        double x1; // bounding box of everything below
+        double y1;
+        double x2;
+        double y2;
+        double coord;          // split coordinate
+        unsigned int child[3];  // LEFT, MIDDLE, RIGHT
+        char xsplit;
+    } FXYFROZEN_NODE;
+
+    typedef struct fxyfrozen_leaf
+    {
+        unsigned int first; // index of the first item in items[]
+        unsigned int count;
+    } FXYFROZEN_LEAF_RANGE;
+
+    typedef struct fxyfrozen
+    {
+        FXYFROZEN_NODE *nodes;
+        FXYFROZEN_LEAF_RANGE *leaves;
+        FXYITEM *items;
+        double *bx1;
+        double *by1;
+        double *bx2;
+        double *by2;
+        unsigned int nNodes;
+        unsigned int nLeaves;
+        unsigned int nItems;
+        int depth;
+    } FXYFROZEN;
+
+    FXYFROZEN *freeze_fxytree(const FXYTREE *tl);
+    void free_fxyfrozen(FXYFROZEN *fr);
+    void *DB_set_fxyfrozen_search_box(const FXYFROZEN *fr,
+                                      double x1, double y1, double x2, double y2);
+    int DB_get_next_fxyfrozen_item(void *handle, FXYITEM **ptr);
+    void DB_free_fxyfrozen_search_box(void *handle);
+
+    /*
+        Search cursor for an FXYTREE that the caller owns, usually on the
+        stack. It starts with room for FXYCURSOR_INLINE_DEPTH pending
+        subtrees and moves to the heap when a search needs more, so it
+        never drops part of the tree. The cursor only reads the tree, so any
+        number of threads may search one tree at the same time as long as
+        nobody registers or unregisters areas meanwhile. Call
+        fxytree_cursor_done() when finished (it only frees a grown stack).
+    */
+#ifndef FXYCURSOR_INLINE_DEPTH
+#define FXYCURSOR_INLINE_DEPTH 64
+#endif
+
+    typedef struct fxycursor
+    {
+        double sx1;
+        double sy1;
+        double sx2;
+        double sy2;
+        struct fsearch_item *stack; // inlineStack, or a heap copy once grown
+        int tos;                    // top of stack, -1 when empty
+        int size;                   // entries available in stack
+        struct fsearch_item inlineStack[FXYCURSOR_INLINE_DEPTH];
+    } FXYCURSOR;
+
+    // Visitor callback. Return TRUE to stop the search.
+    typedef int (*FXYVISITFN)(FXYITEM *item, void *arg);
+
+    void fxytree_cursor_init(FXYCURSOR *c, const FXYTREE *tl,
+                             double x1, double y1, double x2, double y2);
+    int fxytree_cursor_next(FXYCURSOR *c, FXYITEM **ptr);
+    void fxytree_cursor_done(FXYCURSOR *c);
+    int fxytree_visit(const FXYTREE *tl, double x1, double y1, double x2, double y2,
+                      FXYVISITFN fn, void *arg);
+    int fxyfrozen_visit(const FXYFROZEN *fr, double x1, double y1, double x2, double y2,
+                        FXYVISITFN fn, void *arg);
+
+    /*
+        Spatial join. fxytree_join calls fn(a, b, arg) once for every item a
+        of tree A and b of tree B whose boxes are within EXPAND of each
+        other (a's box grown by EXPAND on every side overlaps b's box).
+        fxytree_self_join does the same for every unordered pair of
+        distinct items of one tree. Return TRUE from fn to stop; the join
+        functions then return TRUE.
+    */
+    typedef int (*FXYJOINFN)(FXYITEM *a, FXYITEM *b, void *arg);
+
+    int fxytree_join(const FXYTREE *treeA, const FXYTREE *treeB, double expand,
+                     FXYJOINFN fn, void *arg);
+    int fxytree_self_join(const FXYTREE *tree, double expand,
+                          FXYJOINFN fn, void *arg);
+
+    /*
+        Distance queries. The distance between two boxes is the Euclidean
+        distance between their closest points, 0 when they overlap.
+        fxytree_knn finds the (up to) K items nearest to point (PX, PY) and
+        stores them in items[0..k-1], nearest first, with their distances
+        in dists[] when dists is not NULL; it returns how many it found.
+        fxytree_within finds every item within DIST of the box X1..Y2 and
+        returns their count; *items and *dists (if not NULL) are set to
+        malloc'ed arrays, nearest first, which the caller frees.
+    */
+    int fxytree_knn(const FXYTREE *tree, double px, double py, int k,
+                    FXYITEM **items, double *dists);
+    int fxytree_within(const FXYTREE *tree, double x1, double y1, double x2, double y2,
+                       double dist, FXYITEM ***items, double **dists);
+
+    /*
+        Batched box searches. fxytree_query_batch finds the items of every
+        one of the N search boxes. The results come back in one CSR layout:
+        the hits of boxes[i] are (*items)[offsets[i]] up to, not including,
+        (*items)[offsets[i + 1]]. OFFSETS is supplied by the caller and
+        holds N + 1 entries; *items is malloc'ed (NULL if nothing was found)
+        and freed by the caller. The return value is offsets[n], the total
+        number of hits. Within one box the hits come in tree order.
+    */
+    typedef struct fxyquerybox
+    {
+        double x1;
+        double y1;
+        double x2;
+        double y2;
+    } FXYQUERYBOX;
+
+    int fxytree_query_batch(const FXYTREE *tree, const FXYQUERYBOX *boxes, int n,
+                            int *offsets, FXYITEM ***items);
+
+    /*
+        Copy-on-write, versioned FXYTREE (sdfarea_cow.cxx). One thread
+        writes with fxyvtree_register/unregister/rebalance, which change a
+        private working version by copying the path from the root instead
+        of touching shared nodes, and publishes it with fxyvtree_commit.
+        Any thread may take a snapshot of the last committed version; it
+        does not change, and stays valid, until released. Search a snapshot
+        through fxysnapshot_tree() with any of the read-only FXYTREE
+        searches (cursor, visit, join, knn, freeze, ...).
+    */
+    typedef struct fxyvtree FXYVTREE;
+    typedef struct fxysnapshot FXYSNAPSHOT;
+
+    FXYVTREE *make_fxyvtree(void);
+    void free_fxyvtree(FXYVTREE *vt);
+    void fxyvtree_register(FXYVTREE *vt, double x1, double y1, double x2, double y2,
+                           oslong ud1, oslong ud2);
+    int fxyvtree_unregister(FXYVTREE *vt, double x1, double y1, double x2, double y2,
+                            oslong ud1, oslong ud2);
+    void fxyvtree_rebalance(FXYVTREE *vt);
+    void fxyvtree_commit(FXYVTREE *vt);
+    FXYSNAPSHOT *fxyvtree_snapshot(FXYVTREE *vt);
+    void fxysnapshot_release(FXYSNAPSHOT *snap);
+    const FXYTREE *fxysnapshot_tree(const FXYSNAPSHOT *snap);
+
+    /*
+        Test up to FXY_SCAN_BLOCK boxes, given as parallel coordinate arrays,
+        against a search box. Bit i of the result is set when box i is not
+        DISJOINT from the search box. Uses AVX or SSE2 when the compiler
+        targets them, plain C otherwise; all three give the same bits.
+    */
+#define FXY_SCAN_BLOCK 32
+
+    unsigned int fxy_overlap_mask(const double *x1, const double *y1,
+                                  const double *x2, const double *y2,
+                                  unsigned int n,
+                                  double sx1, double sy1, double sx2, double sy2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDFAREA_H */
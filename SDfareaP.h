@@ -0,0 +1,67 @@
+/**
+ * @file SDfareaP.h
+ * @author Radica
+ * @brief FXYTREE internals shared between sdfarea.c and the C++ builders
+ *        (sdfarea_par.cxx). Not for use outside the area package.
+ * @version 0.1
+ * @date 2024-07-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef SDFAREAP_H
+#define SDFAREAP_H
+
+#include "SDarea.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+        Building blocks of rebalance_fxytree. A rebuild is
+
+            ll = fxytree_unbuild(tl, &owner);
+            sub = rebalance_fxytree_guts(owner, ll, &what);
+            tl->fxyTreePvt = fxy_root_from_subtree(owner, sub, what);
+            fxy_rechunk_items(tl);
+
+        rebalance_fxytree_guts is fxy_split_list applied recursively to the
+        three lists it returns, followed by fxynode_set_built, so a builder
+        that splits the same way gets the same tree whatever order it
+        builds the subtrees in.
+
+        Nodes come from the OWNER passed in, which is not thread safe. A
+        thread building part of a tree uses its own fxy_node_arena_make()
+        owner, and the tree takes its nodes over with fxy_node_arena_adopt()
+        once the thread is done. OWNER is NULL for a tree that is not an
+        FXYTREEX (see fxytree_owner); its nodes are malloc'ed.
+    */
+    FXYTREE *fxytree_owner(const FXYTREE *tl);
+    FXYITEM *fxytree_unbuild(FXYTREE *tl, FXYTREE **owner);
+    FXYTREE_PVT *fxy_split_list(FXYTREE *owner, FXYITEM *ll, int *n, int sizes[3]);
+    solong rebalance_fxytree_guts(FXYTREE *owner, FXYITEM *tl, char *what);
+    void fxynode_set_built(FXYTREE_PVT *t, int n);
+    FXYTREE_PVT *fxy_root_from_subtree(FXYTREE *owner, oslong temp, char what);
+    void fxy_rechunk_items(FXYTREE *x);
+
+    FXYTREE *fxy_node_arena_make(void);
+    void fxy_node_arena_adopt(FXYTREE *tl, FXYTREE *arena);
+
+    /*
+        Single nodes, for the copy-on-write tree (sdfarea_cow.cxx). Copies
+        are malloc'ed and freed with free(); adjust_fbb recomputes a node's
+        bounding box from its children and returns TRUE if it changed.
+    */
+    FXYTREE_PVT *make_fxytree_pvt(double x);
+    FXYTREE_PVT *fxy_copy_node(const FXYTREE_PVT *t);
+    int fxy_node_is_pooled(const FXYTREE_PVT *t);
+    int adjust_fbb(FXYTREE_PVT *tr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDFAREAP_H */
@@ -1639,10 +1639,450 @@ DONE:
     return error;
 }
 
+/*
+    Merging the voids of many elements. The serial and the parallel code
+    both keep the voids of every element in a slot of its own and merge
+    the slots the same way: fpoly_mergeloop, loop by loop, into the list
+    the caller passed in, in element (buffer) order and, within an element,
+    in list order. That order is the canonical one. It is the order of the
+    serial code before the slots, so the merged list is the same in either
+    mode and the same as before. A pairwise tree of merges would join
+    overlapping loops in other places and could not give that list.
+*/
+// Merge every loop of list B into list A, in list order. Consumes B.
+static F_POLYHEAD *dv_merge_void_lists(F_POLYHEAD *a, F_POLYHEAD *b)
+{
+    F_POLYHEAD *next;
+
+    for (F_POLYHEAD *lp = b; lp != NULL; lp = next)
+    {
+        next = lp->next;
+        lp->next = NULL;
+        /*
+            Could possibly do additional checking here, it might same time in polybool later
+            e.g. cline voiding checks if (fpoly_Loop2Shp(shpTree, head, lp)!=PT_OUTSIDE)
+            can't do quite the same here because sometimes lp could be a shape that encompasses
+            head, which returns PT_OUTSIDE, ye needs voided
+            Should try this when there is time with an extra point in loop check
+            where point is any point from head and loop is lp
+        */
+        a = fpoly_mergeloop(a, lp);
+    }
+    return a;
+}
+
+// Merge the voids of ALLVOIDS into *RETVOIDS, slot by slot. The slots are consumed.
+static void dv_merge_void_slots(F_POLYHEAD **retVoids, std::vector<F_POLYHEAD *> &allVoids)
+{
+    for (F_POLYHEAD *&slot : allVoids)
+    {
+        *retVoids = dv_merge_void_lists(*retVoids, slot);
+        slot = NULL;
+    }
+}
+
+/*
+    Bulk voiding of via fences. Via fences along traces and the rows of
+    stitching grids give chains of clearance circles, and where the pitch
+    is below the clearance diameter each circle overlaps the next, so the
+    merge below takes in a fence one overlapping circle at a time. Setting
+    dv_bulk_via_voids joins the circle voids of the vias in the buffer
+    first, while they are still in their slots.
+
+    The circles are grouped by overlap, and each group is cut into chains:
+    runs of circles in which every circle overlaps the one before it and
+    the one after it and no other circle of the run. This is how a fence
+    shows, straight or following a bend, at any pitch; so does a row of a
+    grid whose diagonals stay clear. A chain is only extended while the
+    two places where a circle is cut by its neighbours stay apart (the
+    crossings with one neighbour lie outside the other), and then the
+    outline of the chain is known without a logical operation: the arcs of
+    each circle between its crossings with its neighbours, along one side
+    of the chain and back along the other, round each end. Such an outline
+    has no holes. A group that is one chain becomes that loop. A group cut
+    into several chains (a grid, a fence with a branch) has its chain
+    outlines and lone circles unioned by one LOR over far fewer loops than
+    circles, or left as they are when the LOR fails. The loops take the
+    slot of the first via of the group; groups of fewer than
+    DV_VIA_ARRAY_MIN circles are left alone.
+
+    The voids of a buffer then cover the same area as before in other
+    loops, which changes the list the merge below makes, so this is off
+    unless asked for. Only vias whose void comes back from dv_makehole as
+    one lone circle take part. Nothing in this tree shows that it does so
+    for the vias it is handed with a group buffer; if it groups them
+    itself, no void passes dv_void_circle and this step changes nothing.
+    The callers only run it when groupViaBuf_id is set, which dv_genholes
+    does as soon as the buffer holds a via.
+*/
+#define DV_VIA_ARRAY_MIN 3      // circles in the smallest group done in bulk
+#define DV_VIA_ARRAY_TOL 1.0e-6 // relative tolerance on the circle tests
+
+struct dvViaCircle
+{
+    int slot; // index in allVoids
+    double cx, cy, r;
+    int ccw;                // the void runs counter clockwise
+    std::vector<int> touch; // the circles it overlaps, in index order
+};
+
+// Center and radius of a void that is one circle made of two half arcs.
+static int dv_void_circle(const F_POLYHEAD *v, double *cx, double *cy, double *r)
+{
+    const F_POLYELEM *a;
+    const F_POLYELEM *b;
+    double d;
+
+    if (!v || v->next || v->NextHole || !(a = v->APoint))
+        return FALSE;
+    b = a->Forwards;
+    if (b == a || b->Forwards != a || a->radius == 0.0 || ABS(a->radius) != ABS(b->radius))
+        return FALSE;
+    d = sqrt((b->x - a->x) * (b->x - a->x) + (b->y - a->y) * (b->y - a->y));
+    *r = ABS(a->radius);
+    if (ABS(d - 2.0 * *r) > DV_VIA_ARRAY_TOL * *r)
+        return FALSE;
+    *cx = (a->x + b->x) / 2;
+    *cy = (a->y + b->y) / 2;
+    return TRUE;
+}
+
+static int dv_via_find(std::vector<int> &parent, int i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+/*
+    The points where circles A and B cross, on the left and on the right
+    of the way from A's center to B's. FALSE when they do not cross in two
+    points.
+*/
+static int dv_via_crossings(const dvViaCircle &a, const dvViaCircle &b, double left[2], double right[2])
+{
+    double dx = b.cx - a.cx, dy = b.cy - a.cy;
+    double d = sqrt(dx * dx + dy * dy);
+
+    if (d <= ABS(a.r - b.r) || d >= a.r + b.r)
+        return FALSE;
+    double along = (a.r * a.r - b.r * b.r + d * d) / (2.0 * d);
+    double across = sqrt(MAX(0.0, a.r * a.r - along * along));
+    double ux = dx / d, uy = dy / d;
+
+    left[0] = a.cx + along * ux - across * uy;
+    left[1] = a.cy + along * uy + across * ux;
+    right[0] = a.cx + along * ux + across * uy;
+    right[1] = a.cy + along * uy - across * ux;
+    return TRUE;
+}
+
+static int dv_via_outside(const dvViaCircle &c, const double pt[2])
+{
+    double dx = pt[0] - c.cx, dy = pt[1] - c.cy;
+
+    return (sqrt(dx * dx + dy * dy) > c.r * (1.0 + DV_VIA_ARRAY_TOL));
+}
+
+/*
+    TRUE when circle U may be put next to the end E of CHAIN, on the far
+    side from E's other neighbour P (-1 when E is alone): U crosses E, it
+    overlaps nothing else in the chain, and the crossings of P with E and
+    of E with U lie outside U and P respectively.
+*/
+static int dv_via_chain_fits(const std::vector<dvViaCircle> &circles, const std::vector<int> &inChain, int p, int e, int u)
+{
+    double l1[2], r1[2], l2[2], r2[2];
+
+    for (int w : circles[u].touch)
+    {
+        if (inChain[w] && w != e)
+            return FALSE;
+    }
+    if (!dv_via_crossings(circles[e], circles[u], l2, r2))
+        return FALSE;
+    if (p < 0)
+        return TRUE;
+    if (!dv_via_crossings(circles[p], circles[e], l1, r1))
+        return FALSE;
+    return (dv_via_outside(circles[u], l1) && dv_via_outside(circles[u], r1) && dv_via_outside(circles[p], l2) &&
+            dv_via_outside(circles[p], r2));
+}
+
+/*
+    Cut a group of overlapping circles (MEMBERS, in index order) into
+    chains, each listed from one end to the other. The chains are grown
+    from the lowest free circle, forward and then backward, taking the
+    lowest circle that fits, so the cut does not depend on anything but
+    the input order.
+*/
+static void dv_via_chains(const std::vector<dvViaCircle> &circles, const std::vector<int> &members,
+                          std::vector<std::vector<int>> &chains)
+{
+    std::vector<int> used(circles.size(), FALSE);
+    std::vector<int> inChain(circles.size(), FALSE);
+
+    for (int start : members)
+    {
+        if (used[start])
+            continue;
+        std::vector<int> chain(1, start);
+        used[start] = inChain[start] = TRUE;
+
+        for (int dir = 0; dir < 2; dir++)
+        {
+            for (;;)
+            {
+                int e = dir ? chain.front() : chain.back();
+                int p = chain.size() < 2 ? -1 : (dir ? chain[1] : chain[chain.size() - 2]);
+                int next = -1;
+
+                for (int u : circles[e].touch)
+                {
+                    if (!used[u] && dv_via_chain_fits(circles, inChain, p, e, u))
+                    {
+                        next = u;
+                        break;
+                    }
+                }
+                if (next < 0)
+                    break;
+                used[next] = inChain[next] = TRUE;
+                if (dir)
+                    chain.insert(chain.begin(), next);
+                else
+                    chain.push_back(next);
+            }
+        }
+        for (int c : chain)
+            inChain[c] = FALSE;
+        chains.push_back(chain);
+    }
+}
+
+// Append the arc of circle C from point FROM counter clockwise to point TO, in pieces of at most a half circle.
+static void dv_via_arc(const dvViaCircle &c, const double from[2], const double to[2], std::vector<double> &pts)
+{
+    const double pi = acos(-1.0);
+    double a0 = atan2(from[1] - c.cy, from[0] - c.cx);
+    double sweep = atan2(to[1] - c.cy, to[0] - c.cx) - a0;
+
+    while (sweep <= 0.0)
+        sweep += 2.0 * pi;
+    while (sweep > 2.0 * pi)
+        sweep -= 2.0 * pi;
+    int pieces = (int)ceil(sweep / pi - DV_VIA_ARRAY_TOL);
+    pieces = MAX(pieces, 1);
+    for (int k = 0; k < pieces; k++)
+    {
+        double a = a0 + sweep * k / pieces;
+        pts.push_back(k ? c.cx + c.r * cos(a) : from[0]);
+        pts.push_back(k ? c.cy + c.r * sin(a) : from[1]);
+        pts.push_back(c.r);
+    }
+}
+
+/*
+    The outline of CHAIN, as a new ring on the head of the void of its
+    first circle, running the way that void ran. The other voids of the
+    chain are freed. The ring is made counter clockwise, every arc turning
+    counter clockwise round its circle: along the right hand side of the
+    chain from its first circle to its last, round the last circle, back
+    along the left hand side and round the first one.
+*/
+static F_POLYHEAD *dv_via_chain_outline(const std::vector<dvViaCircle> &circles, const std::vector<int> &chain,
+                                        std::vector<F_POLYHEAD *> &allVoids)
+{
+    int m = (int)chain.size();
+    std::vector<double> left(2 * (m - 1)), right(2 * (m - 1));
+    std::vector<double> pts; // x, y and the radius of the edge leaving the point
+    const dvViaCircle &first = circles[chain[0]];
+
+    for (int k = 0; k < m - 1; k++)
+        dv_via_crossings(circles[chain[k]], circles[chain[k + 1]], &left[2 * k], &right[2 * k]);
+    for (int k = 0; k < m - 1; k++)
+        dv_via_arc(circles[chain[k + 1]], &right[2 * k], k + 1 < m - 1 ? &right[2 * (k + 1)] : &left[2 * k], pts);
+    for (int k = m - 2; k >= 0; k--)
+        dv_via_arc(circles[chain[k]], &left[2 * k], k > 0 ? &left[2 * (k - 1)] : &right[0], pts);
+
+    F_POLYHEAD *h = allVoids[first.slot];
+    F_POLYELEM *p = h->APoint;
+    F_POLYELEM *q = p->Forwards;
+    int n = (int)pts.size() / 3;
+    std::vector<F_POLYELEM *> ring(n);
+
+    SYFree(q);
+    SYFree(p);
+    for (int i = 0; i < n; i++)
+    {
+        // clockwise: the points the other way round, each edge taking the negated radius of the one it reverses
+        int src = first.ccw ? i : n - 1 - i;
+        ring[i] = static_cast<F_POLYELEM *>(SYMalloc(sizeof(F_POLYELEM)));
+        BZERO(ring[i], sizeof(F_POLYELEM));
+        ring[i]->x = pts[3 * src];
+        ring[i]->y = pts[3 * src + 1];
+        ring[i]->radius = first.ccw ? pts[3 * src + 2] : -pts[3 * ((src + n - 1) % n) + 2];
+    }
+    for (int i = 0; i < n; i++)
+    {
+        ring[i]->Forwards = ring[(i + 1) % n];
+        ring[i]->Backwards = ring[(i + n - 1) % n];
+    }
+    h->APoint = ring[0];
+
+    for (int k = 1; k < m; k++)
+    {
+        f_killPolyList(allVoids[circles[chain[k]].slot]);
+        allVoids[circles[chain[k]].slot] = NULL;
+    }
+    allVoids[first.slot] = NULL;
+    return (h);
+}
+
+/**
+ * @brief With dv_bulk_via_voids set, join the overlapping circle voids
+ * among the vias of BUFFER_ID, a fence at a time. ALLVOIDS holds the
+ * voids of the buffer elements by index; the loops of a group end up in
+ * the slot of its first via, the other slots become NULL.
+ */
+static void dv_bulk_via_voids(long buffer_id, std::vector<F_POLYHEAD *> &allVoids)
+{
+    std::vector<dvViaCircle> circles;
+    int cnt = (int)allVoids.size();
+
+    if (!SYGetEnv("dv_bulk_via_voids"))
+        return;
+    for (int i = 0; i < cnt; i++)
+    {
+        dbptr_type elem_ptr;
+        dvViaCircle c;
+
+        bufget(buffer_id, i + 1, &elem_ptr);
+        if (ELEMENT_MASK(elem_ptr) != VIA || !dv_void_circle(allVoids[i], &c.cx, &c.cy, &c.r))
+            continue;
+        c.slot = i;
+        c.ccw = (allVoids[i]->APoint->radius > 0.0);
+        circles.push_back(c);
+    }
+    if ((int)circles.size() < DV_VIA_ARRAY_MIN)
+        return;
+
+    /*
+        Hash the centers into cells one largest diameter wide, so that
+        overlapping circles are in the same or a neighbouring cell, and join
+        every overlapping pair.
+    */
+    int n = (int)circles.size();
+    double cell = 0.0;
+    for (auto &c : circles)
+        cell = MAX(cell, 2.0 * c.r);
+    std::unordered_map<long long, std::vector<int>> grid;
+    auto cellKey = [](long long gx, long long gy) { return (long long)(((unsigned long long)gx << 32) ^ (gy & 0xffffffffLL)); };
+    for (int i = 0; i < n; i++)
+        grid[cellKey((long long)floor(circles[i].cx / cell), (long long)floor(circles[i].cy / cell))].push_back(i);
+
+    std::vector<int> parent(n);
+    for (int i = 0; i < n; i++)
+        parent[i] = i;
+    for (int i = 0; i < n; i++)
+    {
+        dvViaCircle &a = circles[i];
+        long long gx = (long long)floor(a.cx / cell);
+        long long gy = (long long)floor(a.cy / cell);
+        for (long long dx = -1; dx <= 1; dx++)
+        {
+            for (long long dy = -1; dy <= 1; dy++)
+            {
+                auto it = grid.find(cellKey(gx + dx, gy + dy));
+                if (it == grid.end())
+                    continue;
+                for (int j : it->second)
+                {
+                    const dvViaCircle &b = circles[j];
+                    if (j == i)
+                        continue;
+                    double d = sqrt((a.cx - b.cx) * (a.cx - b.cx) + (a.cy - b.cy) * (a.cy - b.cy));
+                    if (d >= a.r + b.r)
+                        continue;
+                    a.touch.push_back(j);
+                    parent[dv_via_find(parent, i)] = dv_via_find(parent, j);
+                }
+            }
+        }
+        std::sort(a.touch.begin(), a.touch.end());
+    }
+
+    // groups in order of their first via, so the result is deterministic
+    std::vector<std::vector<int>> groups;
+    std::unordered_map<int, int> groupOf;
+    for (int i = 0; i < n; i++)
+    {
+        if (circles[i].touch.empty())
+            continue;
+        int root = dv_via_find(parent, i);
+        auto it = groupOf.find(root);
+        if (it == groupOf.end())
+        {
+            groupOf[root] = (int)groups.size();
+            groups.push_back(std::vector<int>(1, i));
+        }
+        else
+            groups[it->second].push_back(i);
+    }
+
+    for (auto &members : groups)
+    {
+        std::vector<std::vector<int>> chains;
+        F_POLYHEAD *list = NULL;
+        F_POLYHEAD **tail = &list;
+        int slot = circles[members[0]].slot;
+
+        if ((int)members.size() < DV_VIA_ARRAY_MIN)
+            continue;
+        dv_via_chains(circles, members, chains);
+        for (auto &chain : chains)
+        {
+            F_POLYHEAD *v;
+            if (chain.size() > 1)
+                v = dv_via_chain_outline(circles, chain, allVoids);
+            else
+            {
+                v = allVoids[circles[chain[0]].slot];
+                allVoids[circles[chain[0]].slot] = NULL;
+            }
+            *tail = v;
+            tail = &v->next;
+        }
+        if (chains.size() > 1)
+        {
+            F_POLYHEAD *merged = f_DoLogicalOperation(list, LOR, NULL);
+            if (merged != NULL && merged != list)
+                f_killPolyList(list);
+            if (merged != NULL)
+                list = merged; // else the chain outlines and circles go to the normal merge
+        }
+        allVoids[slot] = list;
+    }
+}
+
+static long dv_get_all_voids_in_serial(long buffer_id, const FXYTREE *shpTree, shape_type *shape_p,
+                                       const XYTREE *boundaryTree, dvInstData *p_instData,
+                                       const F_POLYHEAD *head, box_type_ptr poly_ext_ptr,
+                                       dbptr_type shp_net, double expandAdjustment, int callFromDRC,
+                                       short groupViaBuf_id, F_POLYHEAD **retVoids,
+                                       int error_handling_scheme, int callFromFast);
+static long dv_get_all_voids_in_parallel(long buffer_id, const FXYTREE *shpTree, shape_type *shape_p,
+                                         const XYTREE *boundaryTree, dvInstData *p_instData,
+                                         const F_POLYHEAD *head, box_type_ptr poly_ext_ptr,
+                                         dbptr_type shp_net, double expandAdjustment, int callFromDRC,
+                                         short groupViaBuf_id, F_POLYHEAD **retVoids,
+                                         int error_handling_scheme, int callFromFast);
+static int dv_voids_can_run_in_parallel(const dvInstData *p_instData, int callFromDRC);
+
 long dv_get_all_voids_in_serial_or_parallel(
     long buffer_id,
-    const FXYTREE *tree;
-    shape_type * shape_p;
+    const FXYTREE *tree,
+    shape_type *shape_p,
     const XYTREE *boundaryTree, // xytree of shape boundary
     dvInstData *p_instData,
     const F_POLYHEAD *head,
@@ -1658,20 +2098,21 @@ long dv_get_all_voids_in_serial_or_parallel(
 
     long error = SUCCESS;
     clock_t c_start = clock();
-    dvSeriaExecutrix &dve = dvSerialExecutrix::getInstance();
-    static int forceSerial = TRUE;
+    dvSerialExecutrix &dve = dvSerialExecutrix::getInstance();
+    // the parallel path has to be asked for, see dv_get_all_voids_in_parallel
+    int parallel = dv_SYEnvIsSet_for_serial_or_parallel("dv_parallel_makehole");
 
-    if (forceSerial || dve.getParallelShapesMode() == false)
+    if (!parallel || dve.getParallelShapesMode() == false || !dv_voids_can_run_in_parallel(p_instData, callFromDRC))
     {
         error = dv_get_all_voids_in_serial(buffer_id, tree, shape_p, boundaryTree,
                                            p_instData, head, poly_ext_ptr, shp_net, expandAdjustment, callFromDRC,
-                                           groupViaBuf_id, voids, error_handling_scheme, callFromFast)
+                                           groupViaBuf_id, voids, error_handling_scheme, callFromFast);
     }
     else
     {
         error = dv_get_all_voids_in_parallel(buffer_id, tree, shape_p, boundaryTree,
                                              p_instData, head, poly_ext_ptr, shp_net, expandAdjustment, callFromDRC,
-                                             groupViaBuf_id, voids, error_handling_scheme, callFromFast)
+                                             groupViaBuf_id, voids, error_handling_scheme, callFromFast);
     }
 
     clock_t c_end = clock();
@@ -1716,8 +2157,7 @@ static long dv_get_all_voids_in_serial(
         error = dv_makehole(shpTree, elem_ptr, shape_p, boundaryTree, p_instData,
                             head, poly_ext_ptr, shp_net, expandAdjustment,
                             callFromDRC, groupViaBuf_id, FALSE, FALSE, callFromFast, FALSE, &extractedVoids);
-        if (extractedVoids)
-            allVoids.push_back(extractedVoids);
+        allVoids.push_back(extractedVoids); // one slot per element, NULL or not
 
         if (error_handling_scheme == 0)
         { // first set of calls to dv_makehole from dv_genholes
@@ -1734,24 +2174,9 @@ static long dv_get_all_voids_in_serial(
                 shp_changed = TRUE; // keep going, according to the original code(thus error overwrite)
         }
     }
-    for (auto x : allVoids)
-    {
-        F_POLYHEAD *next;
-        for (auto lp = x; lp != NULL; lp = next)
-        {
-            next = lp->next;
-            lp->next = NULL;
-            /*
-                Could possibly do additional checking here, it might same time in polybool later
-                e.g. cline voiding checks if (fpoly_Loop2Shp(shpTree, head, lp)!=PT_OUTSIDE)
-                can't do quite the same here because sometimes lp could be a shape that encompasses
-                head, which returns PT_OUTSIDE, ye needs voided
-                Should try this when there is time with an extra point in loop check
-                where point is any point from head and loop is lp
-            */
-            *retVoids = fpoly_mergeloop(*retVoids, lp);
-        }
-    }
+    if (groupViaBuf_id != 0)
+        dv_bulk_via_voids(buffer_id, allVoids);
+    dv_merge_void_slots(retVoids, allVoids);
     if (shp_changed)
     {
         /*
@@ -1763,6 +2188,158 @@ static long dv_get_all_voids_in_serial(
     return error;
 }
 
+/*
+    Parallel form of dv_get_all_voids_in_serial. The dv_makehole calls run
+    on the TBB pool, one element per task. Each worker thread gets its own
+    copy of the caller's dvInstData with a private p_scanSet, the scratch
+    set dv_makehole empties and fills for every object. The parameters are
+    shared and only read.
+
+    dv_makehole is not in this tree, so neither its reentrancy nor what it
+    does with p_thermalsSet and p_drcSet outside PERFECT mode and DRC calls
+    can be checked here, and a scan set cannot be merged back after the
+    join. This path is therefore only taken with dv_parallel_makehole set,
+    which states that dv_makehole is reentrant and at most reads those two
+    sets; the workers then share the caller's. PERFECT mode, which fills
+    the thermal buffer and figure set lazily, and DRC calls, which fill the
+    drc set, stay serial whatever is set (dv_voids_can_run_in_parallel).
+    The polygons are allocated wherever dv_makehole allocates them; there
+    are no per-thread arenas.
+
+    The voids of each element are kept in its own slot and merged
+    afterwards by the same chain as the serial code, in element order, and
+    the errors are looked at in element order, so the result is the serial
+    one whatever the scheduling.
+*/
+struct dvVoidsWorker
+{
+    dvInstData instData;
+    int initialized;
+};
+
+static int dv_voids_can_run_in_parallel(const dvInstData *p_instData, int callFromDRC)
+{
+    return !callFromDRC && !p_instData->thermalBufferID && !p_instData->p_figureSet;
+}
+
+static long dv_get_all_voids_in_parallel(
+    long buffer_id,
+    const FXYTREE *shpTree,
+    shape_type *shape_p,
+    const XYTREE *boundaryTree,
+    dvInstData *p_instData,
+    const F_POLYHEAD *head,
+    box_type_ptr poly_ext_ptr,
+    dbptr_type shp_net,
+    double expandAdjustment,
+    int callFromDRC,
+    short groupViaBuf_id,
+    F_POLYHEAD **retVoids,
+    int error_handling_scheme,
+    int callFromFast)
+{
+    int cnt = bufcount(buffer_id);
+    long error = SUCCESS;
+    int shp_changed = FALSE;
+
+    if (cnt == 0)
+        return error;
+
+    // the buffer is read up front; bufget is not for concurrent use
+    std::vector<dbptr_type> elems(cnt);
+    for (int item = 1; item <= cnt; item++)
+        bufget(buffer_id, item, &elems[item - 1]);
+
+    std::vector<F_POLYHEAD *> allVoids(cnt, NULL);
+    std::vector<long> errors(cnt, SUCCESS);
+    std::vector<char> ran(cnt, FALSE);
+    tbb::enumerable_thread_specific<dvVoidsWorker> workers([] {
+        dvVoidsWorker w;
+        BZERO(&w, sizeof(dvVoidsWorker));
+        return w;
+    });
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, cnt, 1), [&](const tbb::blocked_range<int> &r) {
+        dvVoidsWorker &w = workers.local();
+        if (!w.initialized)
+        {
+            w.instData = *p_instData;
+            w.instData.p_scanSet = NULL;
+            dv_init_scan_set(&w.instData.p_scanSet);
+            w.initialized = TRUE;
+        }
+        for (int i = r.begin(); i != r.end(); i++)
+        {
+            // after a cancel the remaining elements are left with ran FALSE
+            if (UTL_IS_CANCEL)
+                return;
+            ran[i] = TRUE;
+            errors[i] = dv_makehole(shpTree, elems[i], shape_p, boundaryTree, &w.instData,
+                                    head, poly_ext_ptr, shp_net, expandAdjustment,
+                                    callFromDRC, groupViaBuf_id, FALSE, FALSE, callFromFast, FALSE, &allVoids[i]);
+        }
+    });
+
+    for (dvVoidsWorker &w : workers)
+    {
+        if (w.initialized)
+            dv_free_scan_set(&w.instData.p_scanSet);
+    }
+
+    // same error handling as the serial loop, in element order; an element
+    // that was never run fails the call whatever the scheme, as -1 like a
+    // cancel elsewhere, so a partial set of voids is never returned
+    int stop = cnt;
+    for (int i = 0; i < cnt; i++)
+    {
+        error = errors[i];
+        if (!ran[i])
+        {
+            error = -1;
+            stop = i;
+            break;
+        }
+        if (error_handling_scheme == 0)
+        { // first set of calls to dv_makehole from dv_genholes
+            if ((error < 0) || UTL_IS_CANCEL)
+            {
+                stop = i;
+                break;
+            }
+            else if (error > 0)
+                assert(FALSE);
+        }
+        else
+        {
+            if (error < 0)
+            {
+                stop = i;
+                break;
+            }
+            else if (error > 0)
+                shp_changed = TRUE;
+        }
+    }
+    if (stop < cnt)
+    {
+        for (int i = 0; i < cnt; i++)
+            fpoly_CleanUp(&allVoids[i]);
+        return error;
+    }
+
+    if (groupViaBuf_id != 0)
+        dv_bulk_via_voids(buffer_id, allVoids);
+    dv_merge_void_slots(retVoids, allVoids);
+    if (shp_changed)
+        error = 1; // signal the caller that shape has changed, as the serial code does
+    return error;
+}
+
+/*
+    dv_PinPattern is not in this tree, so the p_pinVoidSet, scan set and
+    buffer state it shares through p_instData cannot be made per call
+    here. Until it is, it runs under serialMutex in parallel shapes mode.
+*/
 long dv_PinPattern_for_serial_or_parallel(
     FXYTREE *tree,
     dvInstData *p_instData,
@@ -1770,13 +2347,13 @@ long dv_PinPattern_for_serial_or_parallel(
     dbptr_type shp_ptr,
     F_POLYHEAD *shp,
     F_POLYHEAD **voids,
-    int buffer_if,
+    int buffer_id,
     long items_in_buf,
     double expandAdjustment,
     double SmoothExpand,
     int callFromDRC)
 {
-    dvSerialExecutrix &dve = dvSerialExcutrix::getInstance();
+    dvSerialExecutrix &dve = dvSerialExecutrix::getInstance();
     long retVal = 0;
     if (dve.getParallelShapesMode())
     {
@@ -1932,221 +2509,1730 @@ long dv_genholes(shape_type *shape_p, dvInstData *p_instData,
     */
     shp_changed = FALSE;
 
-    // Get extents of shape being voided
-    // 获取正在进行空洞处理的形状的范围
-    if (head && *head)
+    // Get extents of shape being voided
+    // 获取正在进行空洞处理的形状的范围
+    if (head && *head)
+    {
+        poly_ext_ptr = &poly_ext;
+        fpoly_getextents_box(*head, poly_ext_ptr);
+        if ((*head)->next != NULL)
+        {
+            box_type next_ext;
+            box_type_ptr next_ext_ptr;
+            /*
+                Normally there is just a single poly input. However, for rki
+                clipping Logical operations on the shape against the rki could
+                have fractured the original shape poly into sub polys. So get
+                extent of all parts.
+
+                通常只有一个多边形输入。然而，对于rki剪辑，形状上的逻辑操作可能会将原始形状多边形分割成子多边形。因此获取所有部分的范围。
+            */
+            next_ext_ptr = &next_ext;
+            for (h = (*head)->next; h != NULL; h = h->next)
+            {
+                fpoly_getextents_box(h, next_ext_ptr);
+                ext_union(poly_ext_ptr, next_ext_ptr, poly_ext_ptr);
+            }
+        }
+    }
+    boundary_p = SHAPE_PTR(dba_dynamic_shape_get_boundary(shape_p));
+
+    // Get boundary tree
+    // 获取边界树
+    boundaryTree = dv_GetBoundaryTree(boundary_p);
+
+    for (item = 1; item <= cnt; item++)
+    {
+        bufget(buffer_id, item, &elem_ptr);
+
+        // Screen out non-shapes
+        // 筛选非形状元素
+        if (ELEMENT_MASK(elem_ptr) != SHAPE)
+            continue;
+
+        // Don't process shape under edit or its parent boundary.
+        // 不处理正在编辑的形状或其父边界
+        if ((elem_ptr == shape_p) || (elem_ptr == boundary_p))
+            continue;
+        bufpend(serialOrParallelShp_bufId, &elem_ptr);
+    }
+    error = dv_get_all_voids_in_serial_or_parallel(serialOrParallelShp_bufId, tree,
+                                                   shape_p, boundaryTree, p_instData, head, poly_ext_ptr, shp_net,
+                                                   expandAdjustment, callFromDRC, 0, &voids, 0, callFromFast);
+
+    if ((error < 0) || UTL_IS_CANCEL)
+        goto DONE;
+    else if (error > 0)
+        ASSERT(FALSE);
+
+    /*
+        Process pins here if inline-pins are requested in parameters.
+        note a value of greater than zero for the inline parameter indicates
+        inlining is active and the value supplied is the maximum pin
+        spacing allowable for pins to be inlined.
+
+        如果参数中请求了内联引脚，这里处理引脚。
+        注意：内联参数大于零表示内联是活动的，提供的值是引脚可以内联的最大间距。
+    */
+    if (cl == ETCH)
+    {
+        if (params_p->inline_pin_voids > 0)
+        {
+            error = dv_group_for_serial_or_parallel(tree, p_instData, shp_net, shape_p,
+                                                    *head, &voids, buffer_id, cnt, callFromDRC);
+        }
+        else
+        {
+            if (!p_instData->p_pinVoidSet)
+            {
+                dv_init_scan_set(&p_instData->p_pinVoidSet);
+                localPinVoid = TRUE;
+            }
+
+            // Add in adjustments that would also cause a pattern merge
+            // 加入会导致模式合并的调整
+            if (doSmooth)
+                dv_GetSmoothParam(params_p, TRUE, &SmoothExpand);
+            else
+                SmoothExpand = 0.0;
+
+            SmoothExpand += SmoothExpand; // both elements bump up by smooth
+            // 两个元素都被平滑调整
+            error = dv_PinPattern_for_serial_or_parallel(tree, p_instData, shp_net, shape_p, *head,
+                                                         &voids, buffer_id, cnt, expandAdjustment, SmoothExpand, callFromDRC);
+        }
+    }
+    /*
+        Create voids for every element in buffer (except shapes which were done above).
+        为缓冲区中的每个元素创建空洞（除上述处理过的形状外）。
+    */
+
+    bufrset(serialOrParallelShp_bufId);
+    for (item = 1; item <= cnt; item++)
+    {
+        // Get next item in the buffer
+        // 获取缓冲区中的下一个元素
+        bufget(buffer_id, item, &elem_ptr);
+
+        // We've already processed shapes in loop above
+        // 在上面的循环中我们已经处理了形状
+        if (ELEMENT_MASK(elem_ptr) == SHAPE)
+            continue;
+
+        // We've voided pin patterns above
+        // 我们已经在上面对引脚模式进行了空洞处理
+        if (ELEMENT_MASK(elem_ptr) == VAR_PIN &&
+            dv_is_scan_set_item(elem_ptr, p_instData->p_pinVoidSet))
+            continue;
+
+        // We only want vias and thermal reliefs here
+        // 我们这里只需要过孔和热减容
+        bufpend(serialOrParallelShp_bufId, &elem_ptr);
+
+        if (groupViaBuf_id == 0 && ELEMENT_MASK(elem_ptr) == VIA)
+            bufinit(sizeof(dbptr_type), DV_BUFSIZE_ETCH, DV_BUFSIZE_ETCH, &groupViaBuf_id);
+    }
+    error = dv_get_all_voids_in_serial_or_parallel(serialOrParallelShp_bufId, tree,
+                                                   shape_p, boundaryTree, p_instData, head, poly_ext_ptr, shp_net,
+                                                   expandAdjustment, callFromDRC, groupViaBuf_id, &voids, 1, callFromFast);
+
+    if (groupViaBuf_id != 0)
+        buffree(groupViaBuf_id);
+
+    if (error < 0)
+        goto DONE;
+    else if (error > 0)
+    {
+        error = SUCCESS;
+        shp_changed = TRUE;
+    }
+
+    num_edges = dv_num_edges(voids);
+
+    if ((num_edges == 0) && (!shp_changed))
+    {
+        /*
+            shapes did not change. but could still be multiple polys in the
+            list if clipped to boundary or have been smoothed. Merge them all.
+            Check if need to smooth and merge if asked to do so.
+
+            形状没有改变，但如果剪辑到边界或已被平滑，列表中仍可能有多个多边形。合并它们。
+            检查是否需要平滑并合并（如果要求这样做）。
+        */
+        if (head != NULL && *head != NULL && doSmooth)
+        {
+            merged = TRUE;
+            *head = dv_dosomething(*head, params_p, TRUE, 1, dba_dynamic_shape_get_boundary(shape_p));
+        }
+        goto DONE;
+    }
+
+    // Add in original edges
+    // 加入原始边缘
+    num_edges += dv_num_edges(*head);
+
+    if (num_edges > 0)
+    {
+        if (voids != NULL)
+        {
+            fpoly_CleanUp(head);
+            fpoly_CleanUp(&voids);
+
+            // This removes internal arcs and does polygon smoothing
+            // 这会移除内部弧并进行多边形平滑处理
+            if (params_p->smooth_min_gap)
+                dv_rmv_s_arcs(*head, params_p->smooth_min_gap);
+
+            merged = TRUE;
+
+            if (newVoids)
+                *newVoids = fpoly_CopyPolyList(voids);
+            error = dv_mergefpoly_for_serial_or_parallel(shape_p, p_instData, head, voids, TRUE, doSmooth, callFromDRC);
+            if (error != SUCCESS && error != DV_ERROR_shapeVoidedAway)
+                goto DONE;
+            else
+                error = SUCCESS;
+        }
+        else
+            dv_CleanAndSmooth(head, params_p, doSmooth, FALSE, dba_dynamic_shape_get_boundary(shape_p));
+    }
+DONE:
+    // Cleanup
+    // 清理
+    free_fxytree(tree);
+    if (boundaryTree)
+    {
+        free_xytree(boundaryTree);
+    }
+
+    if (pin_x_area_state_flag)
+    {
+        db_ReleaseFlag_for_serial_or_parallel(pin_x_area_state_flag);
+    }
+    if (localPinVoid)
+    {
+        dv_free_scan_set(&p_instData->p_pinVoidSet);
+    }
+
+DONE1:
+    if (!merged && error == SUCCESS)
+    {
+        if (newVoids)
+            *newVoids = fpoly_CopyPolyList(voids);
+        error = dv_mergefpoly_for_serial_or_parallel(shape_p, p_instData, head, voids, FALSE, FALSE, callFromDRC);
+    }
+    buffree(serialOrParallelShp_bufId);
+
+    return (error);
+}
+
+/*
+    Arcs in an F_POLYELEM ring. The radius on element P belongs to the edge
+    leaving it, from P to P->Forwards: 0 for a line, positive for an arc
+    turning counter clockwise and negative for one turning clockwise. An
+    arc is at most a half circle, so it strays no further than its radius
+    from its chord. The code below that looks at radii, and the packed
+    form, goes by this and takes the direction of an arc from the sign of
+    its radius alone.
+*/
+
+/*
+    dv_merge's search tree of the result polygons. Each stage of dv_merge
+    (LANDNOT, stand-alone separation, clean and smooth, split void capture)
+    changes only some loops of the result, so instead of rebuilding the
+    tree from scratch after each one, dv_merge_tree_sync compares the
+    result with what the tree was loaded from and patches the difference.
+
+    Every top-level loop of the result (a shape with its holes, or a void)
+    is remembered with the tree items fpoly_loadtree made for it and a
+    fingerprint of its elements: their addresses, points and radii. The
+    fingerprint is a sum over the elements, so fpoly_PToHead moving the
+    start point does not count as a change. A loop that is gone or whose
+    fingerprint changed has its items unregistered, a loop that is new or
+    changed is loaded again, and the tree is then rebalanced incrementally.
+
+    Setting dv_merge_tree_rebuild goes back to a full fpoly_SetFpolyTree at
+    every stage.
+
+    fpoly_loadtree and fpoly_SetFpolyTree are not in this tree, so the
+    items of a loop are never made up here: fpoly_loadtree loads the loop
+    into a scratch tree and its items are copied out, whatever their boxes
+    and user data are. Patching then rests on fpoly_SetFpolyTree(list)
+    registering the items fpoly_loadtree makes for each loop of the list
+    on its own. The first sync checks that: it builds the tree with
+    fpoly_SetFpolyTree as before and compares its items with the loops'.
+    When they differ, dv_merge keeps rebuilding the tree at every stage.
+*/
+struct dvTreeLoop
+{
+    unsigned long long print;
+    std::vector<FXYBULKITEM> items;
+};
+
+struct dvMergeTree
+{
+    FXYTREE *xy; // the tree the records below describe
+    std::unordered_map<F_POLYHEAD *, dvTreeLoop> loops;
+    int fullRebuild;
+
+    dvMergeTree() : xy(NULL), fullRebuild(SYGetEnv("dv_merge_tree_rebuild") ? TRUE : FALSE) {}
+};
+
+static unsigned long long dv_mix64(unsigned long long h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static unsigned long long dv_double_bits(double d)
+{
+    unsigned long long b;
+    memcpy(&b, &d, sizeof(b));
+    return b;
+}
+
+// Fingerprint of a loop and its holes, independent of the start points.
+static unsigned long long dv_loop_print(const F_POLYHEAD *h)
+{
+    unsigned long long print = 0;
+
+    for (const F_POLYHEAD *l = h; l != NULL; l = l->NextHole)
+    {
+        const F_POLYELEM *p = l->APoint;
+        print += dv_mix64((unsigned long long)(size_t)l);
+        if (p == NULL)
+            continue;
+        do
+        {
+            print += dv_mix64((unsigned long long)(size_t)p ^
+                              dv_mix64(dv_double_bits(p->x) ^
+                                       dv_mix64(dv_double_bits(p->y) ^ dv_mix64(dv_double_bits(p->radius)))));
+            p = p->Forwards;
+        } while (p != l->APoint);
+    }
+    return print;
+}
+
+static int dv_collect_tree_item(FXYITEM *item, void *arg)
+{
+    FXYBULKITEM b;
+
+    b.x1 = item->x1;
+    b.y1 = item->y1;
+    b.x2 = item->x2;
+    b.y2 = item->y2;
+    b.ud1 = item->ud1;
+    b.ud2 = item->ud2;
+    static_cast<std::vector<FXYBULKITEM> *>(arg)->push_back(b);
+    return FALSE;
+}
+
+static bool dv_tree_item_less(const FXYBULKITEM &a, const FXYBULKITEM &b)
+{
+    if (a.ud1 != b.ud1)
+        return a.ud1 < b.ud1;
+    if (a.ud2 != b.ud2)
+        return a.ud2 < b.ud2;
+    if (a.x1 != b.x1)
+        return a.x1 < b.x1;
+    if (a.y1 != b.y1)
+        return a.y1 < b.y1;
+    if (a.x2 != b.x2)
+        return a.x2 < b.x2;
+    return a.y2 < b.y2;
+}
+
+// The tree items fpoly_loadtree makes for loop H and its holes, through a scratch tree.
+static void dv_loop_tree_items(F_POLYHEAD *h, std::vector<FXYBULKITEM> &items)
+{
+    FXYTREE *tmp = make_fxytree(0.0);
+    F_POLYHEAD *next = h->next;
+
+    h->next = NULL;
+    fpoly_loadtree(h, tmp);
+    h->next = next;
+    fxytree_visit(tmp, -DBL_MAX, -DBL_MAX, DBL_MAX, DBL_MAX, dv_collect_tree_item, &items);
+    free_fxytree(tmp);
+}
+
+static int dv_same_tree_items(std::vector<FXYBULKITEM> &a, std::vector<FXYBULKITEM> &b)
+{
+    if (a.size() != b.size())
+        return FALSE;
+    std::sort(a.begin(), a.end(), dv_tree_item_less);
+    std::sort(b.begin(), b.end(), dv_tree_item_less);
+    return std::equal(a.begin(), a.end(), b.begin(), [](const FXYBULKITEM &x, const FXYBULKITEM &y)
+                      { return !dv_tree_item_less(x, y) && !dv_tree_item_less(y, x); });
+}
+
+/**
+ * @brief Bring *XY up to date with RESULT. A tree the records do not
+ * describe (the first call, or one built elsewhere) is replaced by
+ * fpoly_SetFpolyTree's, and the records are checked against it; otherwise
+ * only the loops that changed are patched.
+ */
+static void dv_merge_tree_sync(dvMergeTree *mt, FXYTREE **xy, F_POLYHEAD *result)
+{
+    if (mt->fullRebuild)
+    {
+        free_fxytree(*xy);
+        *xy = fpoly_SetFpolyTree(result);
+        return;
+    }
+
+    if (*xy != mt->xy || *xy == NULL)
+    {
+        std::vector<FXYBULKITEM> all;
+        std::vector<FXYBULKITEM> built;
+
+        if (*xy)
+            free_fxytree(*xy);
+        *xy = fpoly_SetFpolyTree(result);
+        mt->loops.clear();
+        for (F_POLYHEAD *h = result; h != NULL; h = h->next)
+        {
+            dvTreeLoop &loop = mt->loops[h];
+            loop.print = dv_loop_print(h);
+            dv_loop_tree_items(h, loop.items);
+            all.insert(all.end(), loop.items.begin(), loop.items.end());
+        }
+        if (*xy)
+            fxytree_visit(*xy, -DBL_MAX, -DBL_MAX, DBL_MAX, DBL_MAX, dv_collect_tree_item, &built);
+        if (!dv_same_tree_items(all, built))
+        {
+            if (_dvDebugLogFP != NULL)
+                DV_FPRINTF(_dvDebugLogFP, "dv_merge_tree_sync: %d items loaded by loop, %d by fpoly_SetFpolyTree\n",
+                           (int)all.size(), (int)built.size());
+            mt->loops.clear();
+            mt->fullRebuild = TRUE;
+        }
+        mt->xy = *xy;
+        return;
+    }
+
+    std::unordered_map<F_POLYHEAD *, dvTreeLoop> loops;
+    for (F_POLYHEAD *h = result; h != NULL; h = h->next)
+    {
+        unsigned long long print = dv_loop_print(h);
+        auto it = mt->loops.find(h);
+        if (it != mt->loops.end() && it->second.print == print)
+        {
+            loops[h] = std::move(it->second);
+            mt->loops.erase(it);
+            continue;
+        }
+        dvTreeLoop &loop = loops[h];
+        loop.print = print;
+        dv_loop_tree_items(h, loop.items);
+        for (const FXYBULKITEM &b : loop.items)
+            register_farea(*xy, b.x1, b.y1, b.x2, b.y2, b.ud1, b.ud2);
+    }
+    // what is left in mt->loops was removed or changed
+    for (auto &gone : mt->loops)
+    {
+        for (const FXYBULKITEM &b : gone.second.items)
+            unregister_farea(*xy, b.x1, b.y1, b.x2, b.y2, b.ud1, b.ud2);
+    }
+    mt->loops.swap(loops);
+    rebalance_fxytree_incremental(xy);
+    mt->xy = *xy;
+}
+
+/*
+    Packed polygons. An F_POLYHEAD list is a set of rings of separately
+    allocated F_POLYELEMs, so every walk over it chases pointers. A
+    dvPackedPoly holds the same polygons in flat arrays: the points of all
+    loops one loop after the other in x[], y[] and radius[], loop l being
+    points loopStart[l] .. loopStart[l + 1] - 1, and polygon k (one entry
+    of the next chain) being loops polyStart[k] .. polyStart[k + 1] - 1,
+    its outline followed by its holes in NextHole order. Every loop also
+    keeps its flag and userData; the pointer field is scratch and is not
+    kept. dv_fpoly_pack packs a list and dv_fpoly_unpack_into writes the
+    points back into the same elements, without losing points, radii,
+    loop order or start points, so the stages of dv_merge can move to the
+    packed form one at a time. Setting the direction of the voids
+    (dv_fpack_void_dir) is the first.
+
+    radius[i] is the radius of the edge from point i to the next, as in
+    the note on arcs before dv_merge's search tree. Area, direction and
+    reversal of a loop are straight scans over its arrays.
+*/
+struct dvPackedPoly
+{
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> radius;
+    std::vector<int> loopStart; // loops + 1 entries
+    std::vector<int> polyStart; // polygons + 1 entries
+    std::vector<int> loopFlag;
+    std::vector<void *> loopUserData;
+};
+
+static void dv_fpack_add_loop(dvPackedPoly *pk, const F_POLYHEAD *l)
+{
+    const F_POLYELEM *p = l->APoint;
+
+    if (p != NULL)
+    {
+        do
+        {
+            pk->x.push_back(p->x);
+            pk->y.push_back(p->y);
+            pk->radius.push_back(p->radius);
+            p = p->Forwards;
+        } while (p != l->APoint);
+    }
+    pk->loopFlag.push_back(l->flag);
+    pk->loopUserData.push_back(l->userData);
+    pk->loopStart.push_back((int)pk->x.size());
+}
+
+// Replace the contents of PK with the polygons of HEAD.
+static void dv_fpoly_pack(const F_POLYHEAD *head, dvPackedPoly *pk)
+{
+    pk->x.clear();
+    pk->y.clear();
+    pk->radius.clear();
+    pk->loopStart.assign(1, 0);
+    pk->polyStart.assign(1, 0);
+    pk->loopFlag.clear();
+    pk->loopUserData.clear();
+
+    for (const F_POLYHEAD *h = head; h != NULL; h = h->next)
+    {
+        for (const F_POLYHEAD *l = h; l != NULL; l = l->NextHole)
+            dv_fpack_add_loop(pk, l);
+        pk->polyStart.push_back((int)pk->loopFlag.size());
+    }
+}
+
+/**
+ * @brief Write the points of PK back into HEAD, which must have the same
+ * polygons, loops and point counts (e.g. the list PK was packed from,
+ * after a stage that only moves points). Flags and userData are written
+ * too.
+ *
+ * @return int FALSE, with HEAD untouched, when the layouts differ
+ */
+static int dv_fpoly_unpack_into(const dvPackedPoly *pk, F_POLYHEAD *head)
+{
+    F_POLYHEAD *h;
+    F_POLYHEAD *l;
+    F_POLYELEM *p;
+    int k = 0;
+    int n = 0;
+    int i;
+
+    for (h = head; h != NULL; h = h->next, k++)
+    {
+        if (k + 1 >= (int)pk->polyStart.size())
+            return (FALSE);
+        n = pk->polyStart[k];
+        for (l = h; l != NULL; l = l->NextHole, n++)
+        {
+            int count = 0;
+            if (n >= pk->polyStart[k + 1])
+                return (FALSE);
+            if ((p = l->APoint) != NULL)
+            {
+                do
+                {
+                    count++;
+                    p = p->Forwards;
+                } while (p != l->APoint);
+            }
+            if (count != pk->loopStart[n + 1] - pk->loopStart[n])
+                return (FALSE);
+        }
+        if (n != pk->polyStart[k + 1])
+            return (FALSE);
+    }
+    if (k != (int)pk->polyStart.size() - 1)
+        return (FALSE);
+
+    n = 0;
+    for (h = head; h != NULL; h = h->next)
+    {
+        for (l = h; l != NULL; l = l->NextHole, n++)
+        {
+            l->flag = pk->loopFlag[n];
+            l->userData = pk->loopUserData[n];
+            i = pk->loopStart[n];
+            if ((p = l->APoint) == NULL)
+                continue;
+            do
+            {
+                p->x = pk->x[i];
+                p->y = pk->y[i];
+                p->radius = pk->radius[i];
+                i++;
+                p = p->Forwards;
+            } while (p != l->APoint);
+        }
+    }
+    return (TRUE);
+}
+
+// Area between the chord from (X0, Y0) to (X1, Y1) and its arc of radius R, signed like R.
+static double dv_fpack_arc_segment(double x0, double y0, double x1, double y1, double r)
+{
+    double ar = fabs(r);
+    double half = MIN(1.0, sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0)) / (2.0 * ar));
+    double theta = 2.0 * asin(half);
+    double seg = ar * ar * (theta - sin(theta)) / 2.0;
+
+    return (r > 0.0 ? seg : -seg);
+}
+
+// Signed area of loop L, positive when it runs counter clockwise.
+static double dv_fpack_loop_area(const dvPackedPoly *pk, int l)
+{
+    int s = pk->loopStart[l];
+    int n = pk->loopStart[l + 1] - s;
+    const double *x = pk->x.data() + s;
+    const double *y = pk->y.data() + s;
+    const double *r = pk->radius.data() + s;
+    double twice = 0.0;
+    double arcs = 0.0;
+    int i;
+
+    if (n < 2)
+        return (0.0);
+    for (i = 0; i < n - 1; i++)
+        twice += x[i] * y[i + 1] - x[i + 1] * y[i];
+    twice += x[n - 1] * y[0] - x[0] * y[n - 1];
+    for (i = 0; i < n; i++)
+    {
+        if (r[i] != 0.0)
+        {
+            int j = (i + 1 < n) ? i + 1 : 0;
+            arcs += dv_fpack_arc_segment(x[i], y[i], x[j], y[j], r[i]);
+        }
+    }
+    return (twice / 2.0 + arcs);
+}
+
+// POLY_CCW or POLY_CW, as fpoly_loopdir gives for the unpacked loop.
+static int dv_fpack_loop_dir(const dvPackedPoly *pk, int l)
+{
+    return (dv_fpack_loop_area(pk, l) < 0.0 ? POLY_CW : POLY_CCW);
+}
+
+// Reverse the direction of loop L, keeping its start point.
+static void dv_fpack_loop_reverse(dvPackedPoly *pk, int l)
+{
+    int s = pk->loopStart[l];
+    int n = pk->loopStart[l + 1] - s;
+    double *r = pk->radius.data() + s;
+
+    if (n < 2)
+        return;
+    std::reverse(pk->x.begin() + s + 1, pk->x.begin() + s + n);
+    std::reverse(pk->y.begin() + s + 1, pk->y.begin() + s + n);
+
+    // edge i now runs from old point n - i to old point n - i - 1, the old edge n - i - 1 backwards
+    std::reverse(r, r + n);
+    for (int i = 0; i < n; i++)
+        r[i] = -r[i];
+}
+
+/*
+    Make every void of VOIDS run DIR (POLY_CCW or POLY_CW). A void running
+    the other way is reversed with its holes, so they keep running against
+    it, and only then are the points written back into the elements; the
+    rings themselves, and the pointer marks dv_merge keeps on the heads,
+    are left as they are.
+*/
+static void dv_fpack_void_dir(F_POLYHEAD *voids, int dir)
+{
+    dvPackedPoly pk;
+    int changed = FALSE;
+
+    dv_fpoly_pack(voids, &pk);
+    for (int k = 0; k + 1 < (int)pk.polyStart.size(); k++)
+    {
+        int l = pk.polyStart[k];
+
+        if (pk.loopStart[l + 1] - pk.loopStart[l] < 2 || dv_fpack_loop_dir(&pk, l) == dir)
+            continue;
+        for (; l < pk.polyStart[k + 1]; l++)
+            dv_fpack_loop_reverse(&pk, l);
+        changed = TRUE;
+    }
+    if (changed)
+        dv_fpoly_unpack_into(&pk, voids);
+}
+
+/*
+    Tiled LANDNOT for planes with very many voids. One f_DoLogicalOperation
+    over the whole plane is a single sweep on one core whose cost grows
+    faster than the number of voids, so from DV_TILE_MIN_VOIDS voids on
+    (dv_tile_landnot_min overrides it) the shape extents are cut into tiles
+    by a kd split on the void centres: a cell holding more than
+    DV_TILE_VOIDS voids is halved across its longer side at the median
+    centre, so tiles are small where the voids are dense and large where
+    they are sparse. A void crossing a cut goes to both sides.
+
+    Going down the split, each half of the shape is clipped out of its
+    parent's with LAND against the cell rectangle; a tile then removes the
+    voids touching it with LANDNOT. Coming back up, the two halves are
+    stitched with LOR. Both halves of a cut were clipped at the same
+    coordinate, so their pieces meet exactly along the seam and the union
+    closes it. Only the loops that reach the cut go into that LOR: a loop
+    lying wholly on one side cannot meet anything of the other half and is
+    passed on as it is, and so is a hole clear of the cut, which is taken
+    off its loop for the LOR and put back into the result loop holding it.
+    The halves run in parallel in parallel shapes mode.
+
+    The union leaves a point wherever an edge crossed the cut. Such a point
+    is dropped again when the edges on both sides of it are straight and in
+    line, or are arcs of one circle that together still make at most a
+    half circle; see dv_tile_heal. A seam point between two edges that
+    differ in anything else (e.g. an arc against a line) is kept, so a
+    tiled result can have a few more points than the single LANDNOT but
+    never a different outline.
+
+    Every logical operation is checked as soon as it returns, and the node
+    it ran for is marked failed when logop reports an error or gives a
+    NULL that cannot be an empty result. A clip is empty only when no edge
+    of the shape meets the cell and the cell centre lies outside the shape,
+    a tile only when its voids' extents cover its piece, and a union of two
+    pieces never; the tile check is conservative, so an odd empty tile
+    costs a fallback but never a wrong result. A node that failed, or one
+    of whose halves failed, does a single LANDNOT of its own piece against
+    every void below it instead, so a failure is paid for by its subtree
+    rather than the plane. Each node keeps its piece of the shape until its
+    halves are stitched for that. Only when the LANDNOT of the whole split
+    fails too does dv_merge run the single LANDNOT as before. The logop
+    error is set and read around each operation on the thread running it,
+    as dv_merge does around its own LANDNOT in parallel shapes mode.
+    Setting dv_no_tiled_landnot turns tiling off.
+*/
+#define DV_TILE_MIN_VOIDS 2000 // fewer voids go through one LANDNOT
+#define DV_TILE_VOIDS 256      // voids per tile the split aims for
+#define DV_TILE_MAX_DEPTH 24   // bound on the kd split
+#define DV_TILE_SEAM_EPS 1e-9  // relative tolerance for healing a seam point
+
+struct dvTileBox
+{
+    double x1, y1, x2, y2;
+};
+
+struct dvTileNode
+{
+    dvTileBox box;
+    int child[2];                    // -1 for a tile
+    std::vector<int> ids;            // tiles only: the voids touching box, in list order
+    std::vector<F_POLYHEAD *> voids; // tiles only: a copy of each of those voids, on its own
+    int failed;                      // the piece of this node could not be made
+};
+
+// The clip rectangle of a cell. It lives on the caller's stack and is only ever an operand.
+struct dvTileRect
+{
+    F_POLYHEAD head;
+    F_POLYELEM corner[4];
+};
+
+// Extents of loop H: the box of every edge, grown by its radius for an arc.
+static void dv_tile_loop_box(const F_POLYHEAD *h, dvTileBox *b)
+{
+    const F_POLYELEM *p = h->APoint;
+
+    b->x1 = b->y1 = DBL_MAX;
+    b->x2 = b->y2 = -DBL_MAX;
+    if (p == NULL)
+        return;
+    do
+    {
+        const F_POLYELEM *q = p->Forwards;
+        double r = fabs(p->radius);
+        b->x1 = MIN(b->x1, MIN(p->x, q->x) - r);
+        b->y1 = MIN(b->y1, MIN(p->y, q->y) - r);
+        b->x2 = MAX(b->x2, MAX(p->x, q->x) + r);
+        b->y2 = MAX(b->y2, MAX(p->y, q->y) + r);
+        p = q;
+    } while (p != h->APoint);
+}
+
+static void dv_tile_rect(dvTileRect *r, const dvTileBox *b)
+{
+    static const int cx[4] = {0, 0, 1, 1};
+    static const int cy[4] = {0, 1, 1, 0};
+
+    BZERO(r, sizeof(dvTileRect));
+    for (int i = 0; i < 4; i++)
+    {
+        // clockwise, like the shape outlines dv_merge hands to logop
+        r->corner[i].x = cx[i] ? b->x2 : b->x1;
+        r->corner[i].y = cy[i] ? b->y2 : b->y1;
+        r->corner[i].Forwards = &r->corner[(i + 1) % 4];
+        r->corner[i].Backwards = &r->corner[(i + 3) % 4];
+    }
+    r->head.APoint = &r->corner[0];
+}
+
+// Copy of loop H and its holes, without the loops after it.
+static F_POLYHEAD *dv_tile_copy_loop(F_POLYHEAD *h)
+{
+    F_POLYHEAD *next = h->next;
+    F_POLYHEAD *copy;
+
+    h->next = NULL;
+    copy = fpoly_CopyPolyList(h);
+    h->next = next;
+    return copy;
+}
+
+/**
+ * @brief Split CELL, holding voids IDS, into tiles. Copies of the voids
+ * of each tile are made here, on the calling thread, since copying a
+ * single loop briefly unlinks it from its list.
+ *
+ * @return int index of the node made for CELL
+ */
+static int dv_tile_split(std::vector<dvTileNode> &nodes, F_POLYHEAD **voidArray, const std::vector<dvTileBox> &boxes,
+                         const dvTileBox &cell, std::vector<int> &ids, int maxVoids, int depth)
+{
+    int n = (int)nodes.size();
+
+    nodes.push_back(dvTileNode());
+    nodes[n].box = cell;
+    nodes[n].child[0] = nodes[n].child[1] = -1;
+    nodes[n].failed = FALSE;
+
+    if ((int)ids.size() > maxVoids && depth < DV_TILE_MAX_DEPTH)
+    {
+        int xsplit = (cell.x2 - cell.x1) >= (cell.y2 - cell.y1);
+        std::vector<double> centres;
+
+        centres.reserve(ids.size());
+        for (int i : ids)
+            centres.push_back(xsplit ? (boxes[i].x1 + boxes[i].x2) / 2 : (boxes[i].y1 + boxes[i].y2) / 2);
+        std::nth_element(centres.begin(), centres.begin() + centres.size() / 2, centres.end());
+        double cut = centres[centres.size() / 2];
+
+        if (cut > (xsplit ? cell.x1 : cell.y1) && cut < (xsplit ? cell.x2 : cell.y2))
+        {
+            dvTileBox lowCell = cell;
+            dvTileBox highCell = cell;
+            std::vector<int> lowIds, highIds;
+
+            if (xsplit)
+                lowCell.x2 = highCell.x1 = cut;
+            else
+                lowCell.y2 = highCell.y1 = cut;
+            for (int i : ids)
+            {
+                if ((xsplit ? boxes[i].x1 : boxes[i].y1) <= cut)
+                    lowIds.push_back(i);
+                if ((xsplit ? boxes[i].x2 : boxes[i].y2) >= cut)
+                    highIds.push_back(i);
+            }
+
+            // a cut that every void crosses gains nothing
+            if (lowIds.size() < ids.size() || highIds.size() < ids.size())
+            {
+                std::vector<int>().swap(ids);
+                int low = dv_tile_split(nodes, voidArray, boxes, lowCell, lowIds, maxVoids, depth + 1);
+                int high = dv_tile_split(nodes, voidArray, boxes, highCell, highIds, maxVoids, depth + 1);
+                nodes[n].child[0] = low;
+                nodes[n].child[1] = high;
+                return n;
+            }
+        }
+    }
+
+    for (int i : ids)
+    {
+        F_POLYHEAD *copy = dv_tile_copy_loop(voidArray[i]);
+        if (copy)
+        {
+            nodes[n].ids.push_back(i);
+            nodes[n].voids.push_back(copy);
+        }
+    }
+    return n;
+}
+
+/*
+    Chain the copies of the voids below node N into one list for a
+    LANDNOT, each void once and in list order. CHAIN gets the loops
+    chained, for dv_tile_unchain to take apart again afterwards.
+*/
+static F_POLYHEAD *dv_tile_chain(std::vector<dvTileNode> &nodes, int n, std::vector<F_POLYHEAD *> &chain)
+{
+    std::vector<std::pair<int, F_POLYHEAD *>> all;
+    std::vector<int> stack(1, n);
+
+    while (!stack.empty())
+    {
+        const dvTileNode &node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.child[0] >= 0)
+        {
+            stack.push_back(node.child[0]);
+            stack.push_back(node.child[1]);
+            continue;
+        }
+        for (size_t i = 0; i < node.ids.size(); i++)
+            all.push_back(std::make_pair(node.ids[i], node.voids[i]));
+    }
+    std::stable_sort(all.begin(), all.end(),
+                     [](const std::pair<int, F_POLYHEAD *> &a, const std::pair<int, F_POLYHEAD *> &b) { return a.first < b.first; });
+
+    chain.clear();
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        if (i == 0 || all[i].first != all[i - 1].first)
+            chain.push_back(all[i].second);
+    }
+    for (size_t i = 0; i + 1 < chain.size(); i++)
+        chain[i]->next = chain[i + 1];
+    return (chain.empty() ? NULL : chain[0]);
+}
+
+static void dv_tile_unchain(std::vector<F_POLYHEAD *> &chain)
+{
+    for (F_POLYHEAD *h : chain)
+        h->next = NULL;
+    chain.clear();
+}
+
+// LIST OPERATION OTHER on the calling thread; sets *FAILED when logop reports an error.
+static F_POLYHEAD *dv_tile_logop(F_POLYHEAD *list, int operation, F_POLYHEAD *other, int *failed)
+{
+    F_POLYHEAD *res;
+
+    SetLogopError(SUCCESS);
+    res = f_DoLogicalOperation(list, operation, other);
+    if (GetLogopError() != NULL)
+        *failed = TRUE;
+    return (res);
+}
+
+// TRUE when some loop of LIST reaches into the inside of BOX.
+static int dv_tile_reaches(const F_POLYHEAD *list, const dvTileBox *box)
+{
+    dvTileBox b;
+
+    for (; list != NULL; list = list->next)
+    {
+        dv_tile_loop_box(list, &b);
+        if (b.x2 > box->x1 && b.x1 < box->x2 && b.y2 > box->y1 && b.y1 < box->y2)
+            return (TRUE);
+    }
+    return (FALSE);
+}
+
+// Centre of the arc leaving P, by the sign of its radius (see the note on arcs before the merge tree).
+static void dv_tile_arc_centre(const F_POLYELEM *p, double *cx, double *cy)
+{
+    const F_POLYELEM *q = p->Forwards;
+    double dx = q->x - p->x, dy = q->y - p->y;
+    double dd = dx * dx + dy * dy;
+    double rr = p->radius * p->radius;
+    double h = (dd > 0.0 && rr > dd / 4) ? sqrt((rr - dd / 4) / dd) : 0.0;
+
+    // a counter clockwise arc of at most a half circle has its centre left of the chord
+    if (p->radius < 0.0)
+        h = -h;
+    *cx = (p->x + q->x) / 2 - h * dy;
+    *cy = (p->y + q->y) / 2 + h * dx;
+}
+
+/*
+    Which side of the chord of the edge leaving P the point X, Y is on,
+    counted positive on the side an arc there bulges to: the right of the
+    chord for a counter clockwise arc, the left for a clockwise one.
+*/
+static double dv_tile_bulge_side(const F_POLYELEM *p, double x, double y)
+{
+    const F_POLYELEM *q = p->Forwards;
+    double cross = (q->x - p->x) * (y - p->y) - (q->y - p->y) * (x - p->x);
+
+    return (p->radius > 0.0 ? -cross : cross);
+}
+
+static int dv_tile_in_box(double x, double y, const dvTileBox *b)
+{
+    return (x >= b->x1 && x <= b->x2 && y >= b->y1 && y <= b->y2);
+}
+
+// TRUE when the edge leaving P has a point in BOX, border included.
+static int dv_tile_edge_meets(const F_POLYELEM *p, const dvTileBox *b)
+{
+    const F_POLYELEM *q = p->Forwards;
+
+    if (dv_tile_in_box(p->x, p->y, b) || dv_tile_in_box(q->x, q->y, b))
+        return (TRUE);
+    if (p->radius == 0.0)
+    {
+        // narrow the segment's parameter range to the box, a slab at a time
+        double d[2] = {q->x - p->x, q->y - p->y};
+        double lo[2] = {b->x1 - p->x, b->y1 - p->y};
+        double hi[2] = {b->x2 - p->x, b->y2 - p->y};
+        double t0 = 0.0, t1 = 1.0;
+
+        for (int k = 0; k < 2; k++)
+        {
+            if (d[k] == 0.0)
+            {
+                if (lo[k] > 0.0 || hi[k] < 0.0)
+                    return (FALSE);
+                continue;
+            }
+            double ta = lo[k] / d[k], tb = hi[k] / d[k];
+            t0 = MAX(t0, MIN(ta, tb));
+            t1 = MIN(t1, MAX(ta, tb));
+        }
+        return (t0 <= t1);
+    }
+
+    // an arc with neither end in the box meets it only by crossing a side
+    double dx = q->x - p->x, dy = q->y - p->y;
+    double tol = DV_TILE_SEAM_EPS * (dx * dx + dy * dy);
+    double r = fabs(p->radius);
+    double cx, cy;
+
+    dv_tile_arc_centre(p, &cx, &cy);
+    for (int side = 0; side < 4; side++)
+    {
+        int vertical = (side < 2);
+        double at = vertical ? (side ? b->x2 : b->x1) : (side == 3 ? b->y2 : b->y1);
+        double off = at - (vertical ? cx : cy);
+
+        if (fabs(off) > r)
+            continue;
+        double half = sqrt(r * r - off * off);
+        for (int s = -1; s <= 1; s += 2)
+        {
+            double along = (vertical ? cy : cx) + s * half;
+            double x = vertical ? at : along;
+            double y = vertical ? along : at;
+
+            if (along >= (vertical ? b->y1 : b->x1) && along <= (vertical ? b->y2 : b->x2) &&
+                dv_tile_bulge_side(p, x, y) >= -tol)
+                return (TRUE);
+        }
+    }
+    return (FALSE);
+}
+
+// TRUE when an edge of some loop or hole of LIST meets BOX.
+static int dv_tile_meets(const F_POLYHEAD *list, const dvTileBox *box)
+{
+    for (const F_POLYHEAD *l = list; l != NULL; l = l->next)
+    {
+        for (const F_POLYHEAD *h = l; h != NULL; h = h->NextHole)
+        {
+            const F_POLYELEM *p = h->APoint;
+
+            if (p == NULL)
+                continue;
+            do
+            {
+                if (dv_tile_edge_meets(p, box))
+                    return (TRUE);
+                p = p->Forwards;
+            } while (p != h->APoint);
+        }
+    }
+    return (FALSE);
+}
+
+/*
+    TRUE when X, Y is inside the single loop H, by the crossings of a ray
+    to the right. A loop with arcs is its polygon of chords, with the
+    sliver between every arc and its chord added or taken away, so each
+    sliver holding the point flips the answer once more.
+*/
+static int dv_tile_loop_covers(const F_POLYHEAD *h, double x, double y)
+{
+    const F_POLYELEM *p = h->APoint;
+    int inside = FALSE;
+
+    if (p == NULL)
+        return (FALSE);
+    do
+    {
+        const F_POLYELEM *q = p->Forwards;
+
+        if ((p->y > y) != (q->y > y) && x < p->x + (y - p->y) * (q->x - p->x) / (q->y - p->y))
+            inside = !inside;
+        if (p->radius != 0.0)
+        {
+            double side = dv_tile_bulge_side(p, x, y);
+            double cx, cy;
+
+            // on the chord, the point is taken a hair right of and above where it is, as the ray test takes it
+            if (side == 0.0)
+            {
+                double turn = (q->y != p->y) ? p->y - q->y : q->x - p->x;
+                side = (p->radius > 0.0) ? -turn : turn;
+            }
+            dv_tile_arc_centre(p, &cx, &cy);
+            if ((x - cx) * (x - cx) + (y - cy) * (y - cy) < p->radius * p->radius && side > 0.0)
+                inside = !inside;
+        }
+        p = q;
+    } while (p != h->APoint);
+    return (inside);
+}
+
+// TRUE when X, Y is inside LIST: inside an odd number of its loops and holes.
+static int dv_tile_covers(const F_POLYHEAD *list, double x, double y)
+{
+    int inside = FALSE;
+
+    for (const F_POLYHEAD *l = list; l != NULL; l = l->next)
+    {
+        for (const F_POLYHEAD *h = l; h != NULL; h = h->NextHole)
+        {
+            if (dv_tile_loop_covers(h, x, y))
+                inside = !inside;
+        }
+    }
+    return (inside);
+}
+
+// TRUE when the extents of VOIDS cover the part of SHAPE inside BOX, so LANDNOT may leave nothing.
+static int dv_tile_may_vanish(const F_POLYHEAD *shape, const F_POLYHEAD *voids, const dvTileBox *box)
+{
+    dvTileBox s, v, b;
+    const F_POLYHEAD *h;
+
+    s.x1 = s.y1 = v.x1 = v.y1 = DBL_MAX;
+    s.x2 = s.y2 = v.x2 = v.y2 = -DBL_MAX;
+    for (h = shape; h != NULL; h = h->next)
+    {
+        dv_tile_loop_box(h, &b);
+        s.x1 = MIN(s.x1, b.x1);
+        s.y1 = MIN(s.y1, b.y1);
+        s.x2 = MAX(s.x2, b.x2);
+        s.y2 = MAX(s.y2, b.y2);
+    }
+    for (h = voids; h != NULL; h = h->next)
+    {
+        dv_tile_loop_box(h, &b);
+        v.x1 = MIN(v.x1, b.x1);
+        v.y1 = MIN(v.y1, b.y1);
+        v.x2 = MAX(v.x2, b.x2);
+        v.y2 = MAX(v.y2, b.y2);
+    }
+    s.x1 = MAX(s.x1, box->x1);
+    s.y1 = MAX(s.y1, box->y1);
+    s.x2 = MIN(s.x2, box->x2);
+    s.y2 = MIN(s.y2, box->y2);
+    return (v.x1 <= s.x1 && v.y1 <= s.y1 && v.x2 >= s.x2 && v.y2 >= s.y2);
+}
+
+// SHAPE clipped to BOX, as a new list; SHAPE is left alone. Sets *FAILED when LAND went wrong.
+static F_POLYHEAD *dv_tile_clip(F_POLYHEAD *shape, const dvTileBox *box, int *failed)
+{
+    dvTileRect rect;
+    F_POLYHEAD *clip;
+
+    if (shape == NULL || !dv_tile_reaches(shape, box))
+        return (NULL);
+    dv_tile_rect(&rect, box);
+    clip = dv_tile_logop(shape, LAND, &rect.head, failed);
+    if (clip == shape || clip == &rect.head)
+        clip = fpoly_CopyPolyList(clip);
+
+    // with no edge meeting the cell, the cell is all inside the shape or all outside it
+    if (clip == NULL &&
+        (dv_tile_meets(shape, box) || dv_tile_covers(shape, (box->x1 + box->x2) / 2, (box->y1 + box->y2) / 2)))
+        *failed = TRUE;
+    return (clip);
+}
+
+/*
+    SHAPE, clipped to node N, minus every void below N, by one LANDNOT.
+    Consumes SHAPE. Sets the node's failed flag, and returns NULL, when
+    the LANDNOT went wrong.
+*/
+static F_POLYHEAD *dv_tile_landnot(std::vector<dvTileNode> &nodes, int n, F_POLYHEAD *shape)
+{
+    std::vector<F_POLYHEAD *> chain;
+    F_POLYHEAD *voids;
+    F_POLYHEAD *piece = shape;
+
+    nodes[n].failed = FALSE;
+    if (shape == NULL)
+        return (NULL);
+    voids = dv_tile_chain(nodes, n, chain);
+    if (voids)
+    {
+        piece = dv_tile_logop(shape, LANDNOT, voids, &nodes[n].failed);
+        if (piece == NULL && !dv_tile_may_vanish(shape, voids, &nodes[n].box))
+            nodes[n].failed = TRUE;
+        if (piece != shape)
+            f_killPolyList(shape);
+    }
+    dv_tile_unchain(chain);
+    if (nodes[n].failed && piece)
+    {
+        f_killPolyList(piece);
+        piece = NULL;
+    }
+    return (piece);
+}
+
+/*
+    TRUE when point P of a stitched loop is only there because the loop
+    was cut across it. The edges before and after P must either be
+    straight and in line, or be arcs of one circle that together make at
+    most a half circle. The edge into P has Q's radius and the edge out of
+    it P's, so the two must match, and the edge from Q that replaces both
+    keeps it.
+*/
+static int dv_tile_seam_point(F_POLYELEM *p)
+{
+    F_POLYELEM *q = p->Backwards;
+    F_POLYELEM *s = p->Forwards;
+    double ax = p->x - q->x, ay = p->y - q->y;
+    double bx = s->x - p->x, by = s->y - p->y;
+    double la = sqrt(ax * ax + ay * ay);
+    double lb = sqrt(bx * bx + by * by);
+    double cross = ax * by - ay * bx;
+
+    if (q->radius != p->radius || la == 0.0 || lb == 0.0)
+        return (FALSE);
+    if (p->radius == 0.0)
+        return (ax * bx + ay * by > 0.0 && fabs(cross) <= DV_TILE_SEAM_EPS * la * lb);
+
+    // an arc turns the way its radius says, and a circle through Q, P and S of the arc's radius
+    int ccw = (p->radius > 0.0);
+    if (ccw ? cross <= 0.0 : cross >= 0.0)
+        return (FALSE);
+    double cx = s->x - q->x, cy = s->y - q->y;
+    double twiceR = la * lb * sqrt(cx * cx + cy * cy) / fabs(cross);
+    if (fabs(twiceR - 2.0 * fabs(p->radius)) > DV_TILE_SEAM_EPS * 2.0 * fabs(p->radius))
+        return (FALSE);
+
+    // at most a half circle from Q to S: the angle at P is not acute
+    return (ax * bx + ay * by >= 0.0);
+}
+
+// The cut of node N, and how close to it a point counts as on it.
+static void dv_tile_cut(const std::vector<dvTileNode> &nodes, int n, int *xsplit, double *cut, double *tol)
+{
+    const dvTileBox &box = nodes[n].box;
+    const dvTileBox &low = nodes[nodes[n].child[0]].box;
+
+    *xsplit = (low.x2 < box.x2);
+    *cut = *xsplit ? low.x2 : low.y2;
+    *tol = DV_TILE_SEAM_EPS * MAX(1.0, fabs(*cut));
+}
+
+// TRUE when the extents of loop H reach the cut.
+static int dv_tile_at_cut(const F_POLYHEAD *h, int xsplit, double cut, double tol)
+{
+    dvTileBox b;
+
+    dv_tile_loop_box(h, &b);
+    return (xsplit ? (b.x1 <= cut + tol && b.x2 >= cut - tol) : (b.y1 <= cut + tol && b.y2 >= cut - tol));
+}
+
+/*
+    Drop the points the stitch across node N's cut left behind in LIST.
+    Only points on the cut, within the node's box, are looked at.
+    Elements are SYMalloc'ed by logop, the same as f_killPolyList frees.
+*/
+static void dv_tile_heal(F_POLYHEAD *list, const std::vector<dvTileNode> &nodes, int n)
+{
+    const dvTileBox &box = nodes[n].box;
+    int xsplit;
+    double cut, tol;
+
+    dv_tile_cut(nodes, n, &xsplit, &cut, &tol);
+    for (F_POLYHEAD *l = list; l != NULL; l = l->next)
+    {
+        for (F_POLYHEAD *h = l; h != NULL; h = h->NextHole)
+        {
+            F_POLYELEM *p = h->APoint;
+            int count = 0;
+
+            if (p == NULL)
+                continue;
+            do
+            {
+                count++;
+                p = p->Forwards;
+            } while (p != h->APoint);
+
+            // one pass round the loop, keeping at least three points
+            for (int i = 0; i < count && count > 3;)
+            {
+                F_POLYELEM *next = p->Forwards;
+                double along = xsplit ? p->y : p->x;
+
+                if (fabs((xsplit ? p->x : p->y) - cut) <= tol && along >= (xsplit ? box.y1 : box.x1) &&
+                    along <= (xsplit ? box.y2 : box.x2) && dv_tile_seam_point(p))
+                {
+                    p->Backwards->Forwards = next;
+                    next->Backwards = p->Backwards;
+                    if (h->APoint == p)
+                        h->APoint = next;
+                    SYFree(p);
+                    count--;
+                }
+                else
+                    i++;
+                p = next;
+            }
+        }
+    }
+}
+
+/*
+    Union of the pieces of neighbouring cells of node N, healed along the
+    cut. Only the loops reaching the cut go into the LOR, without their
+    holes that stay clear of it; those holes go back into the result loop
+    around them afterwards. Consumes both. Sets *FAILED, and returns NULL,
+    when the LOR went wrong.
+*/
+static F_POLYHEAD *dv_tile_stitch(std::vector<dvTileNode> &nodes, int n, F_POLYHEAD *a, F_POLYHEAD *b, int *failed)
+{
+    F_POLYHEAD *halves[2] = {a, b};
+    F_POLYHEAD *cross = NULL, **crossEnd = &cross;
+    F_POLYHEAD *kept = NULL, **keptEnd = &kept;
+    std::vector<F_POLYHEAD *> holes;
+    F_POLYHEAD *res;
+    F_POLYHEAD *l, *next;
+    int xsplit;
+    double cut, tol;
+
+    if (a == NULL)
+        return (b);
+    if (b == NULL)
+        return (a);
+    dv_tile_cut(nodes, n, &xsplit, &cut, &tol);
+
+    for (int k = 0; k < 2; k++)
     {
-        poly_ext_ptr = &poly_ext;
-        fpoly_getextents_box(*head, poly_ext_ptr);
-        if ((*head)->next != NULL)
+        for (l = halves[k]; l != NULL; l = next)
         {
-            box_type next_ext;
-            box_type_ptr next_ext_ptr;
-            /*
-                Normally there is just a single poly input. However, for rki
-                clipping Logical operations on the shape against the rki could
-                have fractured the original shape poly into sub polys. So get
-                extent of all parts.
-
-                通常只有一个多边形输入。然而，对于rki剪辑，形状上的逻辑操作可能会将原始形状多边形分割成子多边形。因此获取所有部分的范围。
-            */
-            next_ext_ptr = &next_ext;
-            for (h = (*head)->next; h != NULL; h = h->next)
+            next = l->next;
+            l->next = NULL;
+            if (!dv_tile_at_cut(l, xsplit, cut, tol))
             {
-                fpoly_getextents_box(h, next_ext_ptr);
-                ext_union(poly_ext_ptr, next_ext_ptr, poly_ext_ptr);
+                *keptEnd = l;
+                keptEnd = &l->next;
+                continue;
+            }
+            for (F_POLYHEAD **hp = &l->NextHole; *hp != NULL;)
+            {
+                F_POLYHEAD *h = *hp;
+                if (h->APoint == NULL || dv_tile_at_cut(h, xsplit, cut, tol))
+                {
+                    hp = &h->NextHole;
+                    continue;
+                }
+                *hp = h->NextHole;
+                h->NextHole = NULL;
+                holes.push_back(h);
             }
+            *crossEnd = l;
+            crossEnd = &l->next;
         }
     }
-    boundary_p = SHAPE_PTR(dba_dynamic_shape_get_boundary(shape_p));
-
-    // Get boundary tree
-    // 获取边界树
-    boundaryTree = dv_GetBoundaryTree(boundary_p);
+    if (cross == NULL)
+        return (kept);
+
+    res = dv_tile_logop(cross, LOR, NULL, failed);
+    if (res != cross)
+        f_killPolyList(cross);
+    if (res == NULL)
+        *failed = TRUE;
+    else
+        dv_tile_heal(res, nodes, n);
 
-    for (item = 1; item <= cnt; item++)
+    // the other half stays clear of such a hole, so the loop that took in its old loop holds it
+    for (F_POLYHEAD *h : holes)
     {
-        bufget(buffer_id, item, &elem_ptr);
+        F_POLYHEAD **hp;
 
-        // Screen out non-shapes
-        // 筛选非形状元素
-        if (ELEMENT_MASK(elem_ptr) != SHAPE)
+        for (l = res; l != NULL && !dv_tile_loop_covers(l, h->APoint->x, h->APoint->y); l = l->next)
+            ;
+        if (l == NULL)
+        {
+            *failed = TRUE;
+            f_killPolyList(h);
             continue;
+        }
+        for (hp = &l->NextHole; *hp != NULL; hp = &(*hp)->NextHole)
+            ;
+        *hp = h;
+    }
 
-        // Don't process shape under edit or its parent boundary.
-        // 不处理正在编辑的形状或其父边界
-        if ((elem_ptr == shape_p) || (elem_ptr == boundary_p))
-            continue;
-        bufpend(serialOrParallelShp_bufId, &elem_ptr);
+    if (res == NULL)
+        res = kept;
+    else
+    {
+        for (l = res; l->next != NULL; l = l->next)
+            ;
+        l->next = kept;
     }
-    error = dv_get_all_voids_in_serial_or_parallel(serialOrParallelShp_bufId, tree,
-                                                   shape_p, boundaryTree, p_instData, head, poly_ext_ptr, shp_net,
-                                                   expandAdjustment, callFromDRC, 0, &voids, 0, callFromFast);
+    if (*failed && res)
+    {
+        f_killPolyList(res);
+        res = NULL;
+    }
+    return (res);
+}
 
-    if ((error < 0) || UTL_IS_CANCEL)
-        goto DONE;
-    else if (error > 0)
-        ASSERT(FALSE);
+/*
+    SHAPE, already clipped to node N, minus the voids below N. Consumes
+    SHAPE. When anything below N went wrong, N does one LANDNOT for its
+    whole cell instead; the node is left failed when that went wrong too.
+*/
+static F_POLYHEAD *dv_tile_run(std::vector<dvTileNode> &nodes, int n, F_POLYHEAD *shape, int parallel)
+{
+    dvTileNode &node = nodes[n];
+    F_POLYHEAD *part[2];
+    F_POLYHEAD *res = NULL;
 
-    /*
-        Process pins here if inline-pins are requested in parameters.
-        note a value of greater than zero for the inline parameter indicates
-        inlining is active and the value supplied is the maximum pin
-        spacing allowable for pins to be inlined.
+    if (node.child[0] < 0 || shape == NULL)
+        return (dv_tile_landnot(nodes, n, shape));
 
-        如果参数中请求了内联引脚，这里处理引脚。
-        注意：内联参数大于零表示内联是活动的，提供的值是引脚可以内联的最大间距。
-    */
-    if (cl == ETCH)
+    // both halves are clipped here, so no two threads read one list
+    part[0] = dv_tile_clip(shape, &nodes[node.child[0]].box, &node.failed);
+    part[1] = dv_tile_clip(shape, &nodes[node.child[1]].box, &node.failed);
+
+    if (!node.failed)
     {
-        if (params_p->inline_pin_voids > 0)
+        if (parallel)
         {
-            error = dv_group_for_serial_or_parallel(tree, p_instData, shp_net, shape_p,
-                                                    *head, &voids, buffer_id, cnt, callFromDRC);
+            tbb::parallel_invoke([&] { part[0] = dv_tile_run(nodes, node.child[0], part[0], parallel); },
+                                 [&] { part[1] = dv_tile_run(nodes, node.child[1], part[1], parallel); });
         }
         else
         {
-            if (!p_instData->p_pinVoidSet)
-            {
-                dv_init_scan_set(&p_instData->p_pinVoidSet);
-                localPinVoid = TRUE;
-            }
-
-            // Add in adjustments that would also cause a pattern merge
-            // 加入会导致模式合并的调整
-            if (doSmooth)
-                dv_GetSmoothParam(params_p, TRUE, &SmoothExpand);
-            else
-                SmoothExpand = 0.0;
-
-            SmoothExpand += SmoothExpand; // both elements bump up by smooth
-            // 两个元素都被平滑调整
-            error = dv_PinPattern_for_serial_or_parallel(tree, p_instData, shp_net, shape_p, *head,
-                                                         &voids, buffer_id, cnt, expandAdjustment, SmoothExpand, callFromDRC);
+            part[0] = dv_tile_run(nodes, node.child[0], part[0], parallel);
+            part[1] = dv_tile_run(nodes, node.child[1], part[1], parallel);
         }
+        node.failed = nodes[node.child[0]].failed || nodes[node.child[1]].failed;
     }
-    /*
-        Create voids for every element in buffer (except shapes which were done above).
-        为缓冲区中的每个元素创建空洞（除上述处理过的形状外）。
-    */
-
-    bufrset(serialOrParallelShp_bufId);
-    for (item = 1; item <= cnt; item++)
+    if (!node.failed)
+        res = dv_tile_stitch(nodes, n, part[0], part[1], &node.failed);
+    else
     {
-        // Get next item in the buffer
-        // 获取缓冲区中的下一个元素
-        bufget(buffer_id, item, &elem_ptr);
-
-        // We've already processed shapes in loop above
-        // 在上面的循环中我们已经处理了形状
-        if (ELEMENT_MASK(elem_ptr) == SHAPE)
-            continue;
+        f_killPolyList(part[0]);
+        f_killPolyList(part[1]);
+    }
 
-        // We've voided pin patterns above
-        // 我们已经在上面对引脚模式进行了空洞处理
-        if (ELEMENT_MASK(elem_ptr) == VAR_PIN &&
-            dv_is_scan_set_item(elem_ptr, p_instData->p_pinVoidSet))
-            continue;
+    if (!node.failed)
+    {
+        f_killPolyList(shape);
+        return (res);
+    }
+    if (_dvDebugLogFP != NULL)
+        DV_FPRINTF(_dvDebugLogFP, "dv_tile_run: cell %g %g %g %g done by one LANDNOT\n", node.box.x1, node.box.y1,
+                   node.box.x2, node.box.y2);
+    return (dv_tile_landnot(nodes, n, shape));
+}
 
-        // We only want vias and thermal reliefs here
-        // 我们这里只需要过孔和热减容
-        bufpend(serialOrParallelShp_bufId, &elem_ptr);
+static void dv_tile_free(std::vector<dvTileNode> &nodes)
+{
+    for (dvTileNode &node : nodes)
+    {
+        for (F_POLYHEAD *h : node.voids)
+            f_killPolyList(h);
+        node.voids.clear();
+    }
+}
 
-        if (groupViaBuf_id == 0 && ELEMENT_MASK(elem_ptr) == VIA)
-            bufinit(sizeof(dbptr_type), DV_BUFSIZE_ETCH, DV_BUFSIZE_ETCH, &groupViaBuf_id);
+/**
+ * @brief SHAPE minus VOIDS, worked out tile by tile, into *RESULT (NULL
+ * when nothing is left). Neither list is changed.
+ *
+ * @return int FALSE when the plane has too few voids to be tiled or even
+ * the LANDNOT over the whole split failed; dv_merge then does one LANDNOT.
+ */
+static int dv_tiled_landnot(F_POLYHEAD *shape, F_POLYHEAD *voids, F_POLYHEAD **result)
+{
+    std::vector<F_POLYHEAD *> voidArray;
+    std::vector<dvTileBox> boxes;
+    std::vector<dvTileNode> nodes;
+    std::vector<int> ids;
+    dvTileBox cell, b;
+    F_POLYHEAD *h;
+    int minVoids = DV_TILE_MIN_VOIDS;
+
+    *result = NULL;
+    if (shape == NULL || voids == NULL || SYGetEnv("dv_no_tiled_landnot"))
+        return (FALSE);
+    if (SYGetEnv("dv_tile_landnot_min"))
+        SYGetEnvInt("dv_tile_landnot_min", &minVoids);
+
+    for (h = voids; h != NULL; h = h->next)
+        voidArray.push_back(h);
+    if ((int)voidArray.size() < MAX(minVoids, 2))
+        return (FALSE);
+
+    cell.x1 = cell.y1 = DBL_MAX;
+    cell.x2 = cell.y2 = -DBL_MAX;
+    for (h = shape; h != NULL; h = h->next)
+    {
+        dv_tile_loop_box(h, &b);
+        cell.x1 = MIN(cell.x1, b.x1);
+        cell.y1 = MIN(cell.y1, b.y1);
+        cell.x2 = MAX(cell.x2, b.x2);
+        cell.y2 = MAX(cell.y2, b.y2);
     }
-    error = dv_get_all_voids_in_serial_or_parallel(serialOrParallelShp_bufId, tree,
-                                                   shape_p, boundaryTree, p_instData, head, poly_ext_ptr, shp_net,
-                                                   expandAdjustment, callFromDRC, groupViaBuf_id, &voids, 1, callFromFast);
+    if (cell.x1 >= cell.x2 || cell.y1 >= cell.y2)
+        return (FALSE);
 
-    if (groupViaBuf_id != 0)
-        buffree(groupViaBuf_id);
+    // voids clear of the shape extents cannot change the result
+    boxes.resize(voidArray.size());
+    for (int i = 0; i < (int)voidArray.size(); i++)
+    {
+        dv_tile_loop_box(voidArray[i], &boxes[i]);
+        if (boxes[i].x2 >= cell.x1 && boxes[i].x1 <= cell.x2 && boxes[i].y2 >= cell.y1 && boxes[i].y1 <= cell.y2)
+            ids.push_back(i);
+    }
 
-    if (error < 0)
-        goto DONE;
-    else if (error > 0)
+    dv_tile_split(nodes, voidArray.data(), boxes, cell, ids, DV_TILE_VOIDS, 0);
+    if (nodes.size() == 1)
     {
-        error = SUCCESS;
-        shp_changed = TRUE;
+        // nothing to split along
+        dv_tile_free(nodes);
+        return (FALSE);
     }
 
-    num_edges = dv_num_edges(voids);
+    *result = dv_tile_run(nodes, 0, fpoly_CopyPolyList(shape), dvSerialExecutrix::getInstance().getParallelShapesMode());
+    dv_tile_free(nodes);
+    if (nodes[0].failed)
+        return (FALSE);
+    // a subtree that fell back leaves its logop error behind
+    SetLogopError(SUCCESS);
+    return (TRUE);
+}
 
-    if ((num_edges == 0) && (!shp_changed))
-    {
-        /*
-            shapes did not change. but could still be multiple polys in the
-            list if clipped to boundary or have been smoothed. Merge them all.
-            Check if need to smooth and merge if asked to do so.
+/*
+    Union of a long void list. One LOR over the whole list takes every
+    void into the same pass, however far apart two of them lie, so from
+    DV_UNION_MIN_VOIDS voids on the voids are ordered along a Z-order curve
+    through their centres, cut into runs of DV_UNION_GROUP voids that lie
+    near each other, and every run is unioned on its own. The partial
+    unions are then unioned pairwise as a balanced tree, scheduled like the
+    tiles of dv_tiled_landnot. The tree is cut by position in the Z-order
+    only, so the order of the LORs does not depend on the threads.
+
+    Two partial unions are each made of separate loops already, so only a
+    loop whose extents overlap those of a loop of the other half, borders
+    included, can change when they are unioned. dv_union_join finds those
+    pairs with a sweep along x, puts just their loops through the LOR and
+    splices the others in unchanged; two halves with no such pair are
+    simply spliced. A run at the bottom always goes through its LOR, which
+    also cleans up the voids as the one LOR over the list did.
+*/
+#define DV_UNION_MIN_VOIDS 1024 // fewer voids go through one LOR
+#define DV_UNION_GROUP 256      // voids unioned by one LOR at the bottom of the tree
 
-            形状没有改变，但如果剪辑到边界或已被平滑，列表中仍可能有多个多边形。合并它们。
-            检查是否需要平滑并合并（如果要求这样做）。
-        */
-        if (head != NULL && *head != NULL && doSmooth)
+// Interleave the low 16 bits of V with zeros.
+static unsigned int dv_union_spread(unsigned int v)
+{
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+/*
+    Union of LEFT and RIGHT, each the result of a LOR, so that no two
+    loops of one of them overlap. Consumes both. NULL when the LOR failed.
+*/
+static F_POLYHEAD *dv_union_join(F_POLYHEAD *left, F_POLYHEAD *right)
+{
+    F_POLYHEAD *halves[2] = {left, right};
+    std::vector<F_POLYHEAD *> loops;
+    std::vector<dvTileBox> boxes;
+    std::vector<int> half, order, active;
+    std::vector<char> hit;
+    F_POLYHEAD *cross = NULL, **crossEnd = &cross;
+    F_POLYHEAD *kept = NULL, **keptEnd = &kept;
+    F_POLYHEAD *res, *h, *next;
+
+    for (int k = 0; k < 2; k++)
+    {
+        for (h = halves[k]; h != NULL; h = next)
         {
-            merged = TRUE;
-            *head = dv_dosomething(*head, params_p, TRUE, 1, dba_dynamic_shape_get_boundary(shape_p));
+            next = h->next;
+            h->next = NULL;
+            loops.push_back(h);
+            half.push_back(k);
         }
-        goto DONE;
+    }
+    boxes.resize(loops.size());
+    hit.assign(loops.size(), 0);
+    for (int i = 0; i < (int)loops.size(); i++)
+    {
+        dv_tile_loop_box(loops[i], &boxes[i]);
+        order.push_back(i);
     }
 
-    // Add in original edges
-    // 加入原始边缘
-    num_edges += dv_num_edges(*head);
+    // sweep along x, keeping the loops whose extents still reach the sweep line
+    std::stable_sort(order.begin(), order.end(), [&boxes](int a, int b) { return boxes[a].x1 < boxes[b].x1; });
+    for (int i : order)
+    {
+        size_t still = 0;
+        for (int a : active)
+        {
+            if (boxes[a].x2 < boxes[i].x1)
+                continue;
+            active[still++] = a;
+            if (half[a] != half[i] && boxes[a].y1 <= boxes[i].y2 && boxes[a].y2 >= boxes[i].y1)
+                hit[a] = hit[i] = 1;
+        }
+        active.resize(still);
+        active.push_back(i);
+    }
 
-    if (num_edges > 0)
+    for (int i = 0; i < (int)loops.size(); i++)
     {
-        if (voids != NULL)
+        if (hit[i])
         {
-            fpoly_CleanUp(head);
-            fpoly_CleanUp(&voids);
+            *crossEnd = loops[i];
+            crossEnd = &loops[i]->next;
+        }
+        else
+        {
+            *keptEnd = loops[i];
+            keptEnd = &loops[i]->next;
+        }
+    }
+    if (cross == NULL)
+        return (kept);
 
-            // This removes internal arcs and does polygon smoothing
-            // 这会移除内部弧并进行多边形平滑处理
-            if (params_p->smooth_min_gap)
-                dv_rmv_s_arcs(*head, params_p->smooth_min_gap);
+    res = f_DoLogicalOperation(cross, LOR, NULL);
+    if (res != cross)
+        f_killPolyList(cross);
+    if (res == NULL)
+    {
+        f_killPolyList(kept);
+        return (NULL);
+    }
+    for (h = res; h->next; h = h->next)
+        ;
+    h->next = kept;
+    return (res);
+}
 
-            merged = TRUE;
+// Union of copies[lo, hi), consumed. NULL when a LOR failed.
+static F_POLYHEAD *dv_union_range(std::vector<F_POLYHEAD *> &copies, int lo, int hi, int parallel)
+{
+    F_POLYHEAD *left = NULL;
+    F_POLYHEAD *right = NULL;
+    F_POLYHEAD *res;
 
-            if (newVoids)
-                *newVoids = fpoly_CopyPolyList(voids);
-            error = dv_mergefpoly_for_serial_or_parallel(shape_p, p_instData, head, voids, TRUE, doSmooth, callFromDRC);
-            if (error != SUCCESS && error != DV_ERROR_shapeVoidedAway)
-                goto DONE;
-            else
-                error = SUCCESS;
+    if (hi - lo <= DV_UNION_GROUP)
+    {
+        for (int i = hi - 1; i >= lo; i--)
+        {
+            copies[i]->next = left;
+            left = copies[i];
+            copies[i] = NULL;
         }
-        else
-            dv_CleanAndSmooth(head, params_p, doSmooth, FALSE, dba_dynamic_shape_get_boundary(shape_p));
     }
-DONE:
-    // Cleanup
-    // 清理
-    free_fxytree(tree);
-    if (boundaryTree)
+    else
     {
-        free_xytree(boundaryTree);
+        int mid = lo + (hi - lo) / 2;
+        if (parallel)
+        {
+            tbb::parallel_invoke([&] { left = dv_union_range(copies, lo, mid, parallel); },
+                                 [&] { right = dv_union_range(copies, mid, hi, parallel); });
+        }
+        else
+        {
+            left = dv_union_range(copies, lo, mid, parallel);
+            right = dv_union_range(copies, mid, hi, parallel);
+        }
+        if (left == NULL || right == NULL)
+        {
+            f_killPolyList(left);
+            f_killPolyList(right);
+            return (NULL);
+        }
+        return (dv_union_join(left, right));
     }
 
-    if (pin_x_area_state_flag)
+    res = f_DoLogicalOperation(left, LOR, NULL);
+    if (res != left)
+        f_killPolyList(left);
+    return (res);
+}
+
+/**
+ * @brief f_DoLogicalOperation(voids, LOR, NULL), done as a spatially
+ * grouped reduction when the list is long. VOIDS is not changed.
+ */
+static F_POLYHEAD *dv_union_voids(F_POLYHEAD *voids)
+{
+    std::vector<std::pair<unsigned int, F_POLYHEAD *>> order;
+    std::vector<F_POLYHEAD *> copies;
+    std::vector<dvTileBox> boxes;
+    dvTileBox ext;
+    F_POLYHEAD *h;
+    F_POLYHEAD *result;
+    int i;
+
+    for (h = voids; h != NULL; h = h->next)
+        order.push_back(std::make_pair(0u, h));
+    if ((int)order.size() < DV_UNION_MIN_VOIDS)
+        return (f_DoLogicalOperation(voids, LOR, NULL));
+
+    boxes.resize(order.size());
+    ext.x1 = ext.y1 = DBL_MAX;
+    ext.x2 = ext.y2 = -DBL_MAX;
+    for (i = 0; i < (int)order.size(); i++)
     {
-        db_ReleaseFlag_for_serial_or_parallel(pin_x_area_state_flag);
+        dv_tile_loop_box(order[i].second, &boxes[i]);
+        ext.x1 = MIN(ext.x1, boxes[i].x1);
+        ext.y1 = MIN(ext.y1, boxes[i].y1);
+        ext.x2 = MAX(ext.x2, boxes[i].x2);
+        ext.y2 = MAX(ext.y2, boxes[i].y2);
     }
-    if (localPinVoid)
+    double sx = ext.x2 > ext.x1 ? 65535.0 / (ext.x2 - ext.x1) : 0.0;
+    double sy = ext.y2 > ext.y1 ? 65535.0 / (ext.y2 - ext.y1) : 0.0;
+    for (i = 0; i < (int)order.size(); i++)
     {
-        dv_free_scan_set(&p_instData->p_pinVoidSet);
+        unsigned int gx = (unsigned int)(((boxes[i].x1 + boxes[i].x2) / 2 - ext.x1) * sx);
+        unsigned int gy = (unsigned int)(((boxes[i].y1 + boxes[i].y2) / 2 - ext.y1) * sy);
+        order[i].first = dv_union_spread(gx) | (dv_union_spread(gy) << 1);
     }
+    // stable, so equal keys keep their list order
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<unsigned int, F_POLYHEAD *> &a, const std::pair<unsigned int, F_POLYHEAD *> &b) { return a.first < b.first; });
 
-DONE1:
-    if (!merged && error == SUCCESS)
+    copies.reserve(order.size());
+    for (i = 0; i < (int)order.size(); i++)
     {
-        if (newVoids)
-            *newVoids = fpoly_CopyPolyList(voids);
-        error = dv_mergefpoly_for_serial_or_parallel(shape_p, p_instData, head, voids, FALSE, FALSE, callFromDRC);
+        F_POLYHEAD *copy = dv_tile_copy_loop(order[i].second);
+        if (copy == NULL)
+            break;
+        copies.push_back(copy);
+    }
+    if (copies.size() != order.size())
+    {
+        for (F_POLYHEAD *c : copies)
+            f_killPolyList(c);
+        return (f_DoLogicalOperation(voids, LOR, NULL));
     }
-    buffree(serialOrParallelShp_bufId);
 
-    return (error);
+    result = dv_union_range(copies, 0, (int)copies.size(),
+                            dvSerialExecutrix::getInstance().getParallelShapesMode());
+    if (result == NULL)
+        result = f_DoLogicalOperation(voids, LOR, NULL);
+    return (result);
 }
 
 /*
@@ -2161,6 +4247,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
                      int doSmooth, int callFromDRC)
 {
     FXYTREE *xy;
+    dvMergeTree mergeTree; // keeps xy in step with result, see dv_merge_tree_sync
     F_POLYHEAD *h;
     F_POLYHEAD *lastHole, *lastShape, *nextHole;
     F_POLYHEAD *currVoid, *currHole, *nextVoid, *tempRes;
@@ -2295,11 +4382,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
         反转孔的方向，之后它们就变成正确的逆时针的孔了。这对于dv_StripVoids正确工作
         来说是必要的。一旦它们方向正确，就可以从shape和voids中创建一个xy树
     */
-    for (h = *voids; h != NULL; h = h->next)
-    {
-        if (fpoly_loopdir(h->APoint) == POLY_CW)
-            fpoly_reverse();
-    }
+    dv_fpack_void_dir(*voids, POLY_CCW);
 
     /*
         Remove any voids that are outside shape(or inside other voids)
@@ -2437,11 +4520,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
 
     /* Put the voids back to their original direction (CW) for logop */
     // 将孔放回它们原来的方向（顺时针），用于logop
-    for (h = *voids; h != NULL; h = h->next)
-    {
-        if (fpoly_loopdir(h->APoint) == POLY_CCW)
-            fpoly_reverse(h);
-    }
+    dv_fpack_void_dir(*voids, POLY_CW);
 
     if (standAloneVoids && existedVoids)
     {
@@ -2504,8 +4583,12 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
                     ++numStart;
             }
         */
-        SetLogopError(SUCCESS);
-        result = f_DoLogicalOperation(*shape, operation, *voids);
+        // planes with very many voids are done tile by tile, see dv_tiled_landnot
+        if (operation != LANDNOT || !dv_tiled_landnot(*shape, *voids, &result))
+        {
+            SetLogopError(SUCCESS);
+            result = f_DoLogicalOperation(*shape, operation, *voids);
+        }
         if (!result)
         {
             // if failed because of Logical Op error, alert user.
@@ -2513,7 +4596,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
             if (errorMsg)
                 SYPrintf(MSG_INFO(), errorMsg);
 
-            voidsResult = f_DoLogicalOperation(*voids, LOR, NULL);
+            voidsResult = dv_union_voids(*voids);
             result = *shape;
             *shape = NULL;
 
@@ -2564,8 +4647,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
             Reload new polygon structure into search tree.
             // 读取新的多边形结构进搜索树
         */
-        free_fxytree(xy);
-        xy = fpoly_SetFpolyTree(result);
+        dv_merge_tree_sync(&mergeTree, &xy, result);
     }
     // add smooth run in callFromDRC for "dv_fixfullcontact" if any Flood Pin was fixed()
     if (doSmooth && !doClean && callFromDrc && SYEnvIsSet("dv_fixfullcontact"))
@@ -2586,8 +4668,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
         */
         if (*voids == NULL)
         {
-            free_fxytree(xy);
-            xy = fpoly_SetFpolyTree(result);
+            dv_merge_tree_sync(&mergeTree, &xy, result);
         }
         fpoly_MatchVoidsToShapes(FALSE, xy, result, standAloneVoids);
         if (UTL_IS_CANCEL)
@@ -2613,8 +4694,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
             Reload new polygon structure into search tree
             重新将多边形结构读入搜索树
         */
-        free_fxytree(xy);
-        xy = fpoly_SetFpolyTree(result);
+        dv_merge_tree_sync(&mergeTree, &xy, result);
         fpoly_SeparateVoidsFromShp(result, FALSE, &smoothVoids);
         fpoly_PToHead(smoothVoids);
 
@@ -2672,7 +4752,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
             {
                 fpoly_reverse_list(standAloneSmooth);
             }
-            dv_CleanAndSmooth(&standAloneSmooth, params_p, doSmooth, TRUE, dba_dynamic_shape_get_b);
+            dv_CleanAndSmooth(&standAloneSmooth, params_p, doSmooth, TRUE, dba_dynamic_shape_get_boundary(shape_p));
             if (dv_smooth_land)
             {
                 fpoly_reverse_list(standAloneSmooth);
@@ -2688,8 +4768,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
             if (smoothVoids && calculateNumVoids(standAloneSmooth) > 0)
                 dv_isNewVoidsIncludeVoids(&copyStandAloneSmooth, &standAloneSmooth, &smoothVoid);
 
-            free_fxytree(xy);
-            xy = fpoly_SetFpolyTree(result);
+            dv_merge_tree_sync(&mergeTree, &xy, result);
             if (copyStandAloneSmooth)
             {
                 f_killPolyList(copyStandAloneSmooth);
@@ -2718,7 +4797,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
             dv_debug_fpoly_drawshp_sc(result, TRUE, "REMOVE STANDALONE", callFromDRC ? 2 : 1);
         }
 
-        dv_CleanAndSmooth(&result, params_p, doSmooth, FALSE, dba_dynamic_shape_get_boundary(shaep_));
+        dv_CleanAndSmooth(&result, params_p, doSmooth, FALSE, dba_dynamic_shape_get_boundary(shape_p));
         {
             /*
                 Set this to turn on/off repair_quickout
@@ -2749,8 +4828,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
                 Reload new polygon structure into search tree
                 重新加载多边形结构到搜索树里
             */
-            free_fxytree(xy);
-            xy = fpoly_SetFpolyTree(result);
+            dv_merge_tree_sync(&mergeTree, &xy, result);
 
             /*
                 Match stand-alone circles with their enclosing shapes
@@ -2793,8 +4871,7 @@ F_POLYHEAD *dv_merge(shape_type *shape_p, F_POLYHEAD **shape, F_POLYHEAD **voids
                 重新加载多边形结构到搜索树中。因为此前的f_Dlogop没有做，在创建一个新树后
                 旧树将会变得不合法因为fpoly_CleanUp中的改变没有修改树。
             */
-            free_fxytree(xy);
-            xy = fpoly_SetFpolyTree(result);
+            dv_merge_tree_sync(&mergeTree, &xy, result);
         }
         /*
             Match stand-alone voids with their enclosing shapes.
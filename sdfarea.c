@@ -12,10 +12,19 @@
  */
 
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 #include "osassert.h"
 #include "osstdlib.h"
 #include "oslimits.h"
 #include "SDarea.h"
+#include "SDfarea.h"
+#include "SDfareaP.h"
 #include "SYchunk.h"
 
 /*
@@ -27,6 +36,101 @@
 #define TEXT_out(s)
 #endif
 
+/*
+    A candidate split for rebalance_fxytree_guts, and its expected cost in
+    items looked at per search (see fxy_best_split).
+*/
+#define FXY_SPLIT_BINS 16
+
+typedef struct fxysplit
+{
+    double coord;
+    double cost;
+} FXYSPLIT;
+
+/*
+    One side of a spatial join: either a tree node or a leaf list, with the
+    bounding box of what it holds. Lists carry no box of their own, so the
+    join works each one out once and keeps it in the context (see
+    fxyslot_bbox).
+*/
+typedef struct fxyjoinslot
+{
+    oslong addr;
+    char is_list;
+    double x1, y1, x2, y2;
+} FXYJOINSLOT;
+
+typedef struct fxyjoinbox
+{
+    oslong list; // 0 for a free entry
+    double x1, y1, x2, y2;
+} FXYJOINBOX;
+
+typedef struct fxyjoinctx
+{
+    double expand;
+    FXYJOINFN fn;
+    void *arg;
+    FXYJOINBOX *boxes; // open addressed by list address, size a power of two
+    int nBoxes;
+    int size;
+} FXYJOINCTX;
+
+/*
+    Best-first distance search. The queue holds nodes, leaf lists and
+    items keyed by their squared distance to the query box; popping an
+    item means no closer item remains anywhere in the queue.
+*/
+#define FXYNEAR_NODE 0
+#define FXYNEAR_LIST 1
+#define FXYNEAR_ITEM 2
+
+typedef struct fxynear_entry
+{
+    double d2;
+    oslong addr;
+    char kind;
+} FXYNEAR_ENTRY;
+
+typedef struct fxynear
+{
+    double qx1, qy1, qx2, qy2;
+    FXYNEAR_ENTRY *heap;
+    int n;
+    int size;
+} FXYNEAR;
+
+/*
+    Batched searches. The boxes are sorted along a Morton (Z-order) curve
+    and walked through the tree FXY_BATCH_GROUP at a time, with a bitmask of
+    the boxes of the group that are still alive in the current subtree.
+    Every hit is first recorded as a (box, item) pair and the pairs are
+    bucketed per box at the end.
+*/
+#define FXY_BATCH_GROUP 32 // bits in the unsigned int box masks
+
+typedef struct fxybatchbox
+{
+    double x1, y1, x2, y2;
+    unsigned int key; // Morton code of the box center
+    int index;        // position in the caller's array
+} FXYBATCHBOX;
+
+typedef struct fxybatchhit
+{
+    int index;
+    FXYITEM *item;
+} FXYBATCHHIT;
+
+typedef struct fxybatch
+{
+    FXYBATCHBOX *group; // the boxes of the current group
+    FXYBATCHHIT *hits;
+    int nHits;
+    int size;
+} FXYBATCH;
+
 #define SEARCHCALL_U1U2(a, start, fn)           \
     {                                           \
         for (a = start; a != NULL; a = a->next) \
@@ -44,19 +148,41 @@
             }                                   \
     }
 
-#define RETURN_LL          \
-    {                      \
-        *what = TRUE;      \
-        return (oslong)ll; \
-    }
-
 __STATIC(FXYITEM *gimme_new_fxyitem, (void *));
-__STATIC(int adjust_fbb, (FXYTREE_PVT * tr));
-__STATIC(int fttl, (int n));
-__STATIC(oslong rebalance_fxytree_guts, (FXYITEM * tl, char *what));
+__STATIC(FXYITEM *gimme_fxyitem, (FXYTREE * tl));
+__STATIC(void give_back_fxyitem, (FXYTREE * tl, FXYITEM *a));
+__STATIC(void fxy_best_split, (FXYITEM * ll, int n, int xsplit, double lo, double hi, FXYSPLIT *best));
+__STATIC(void fxytree_stats_walk, (const FXYTREE_PVT *t, int depth, FXYSTATS *st, double *w, double *h));
+__STATIC(double fxytree_cost_walk, (const FXYTREE_PVT *t, double qw, double qh, double area));
+__STATIC(FXYTREE_PVT *gimme_new_fxynode, (FXYTREE * owner, double x));
+__STATIC(void give_back_fxynode, (FXYTREE * owner, FXYTREE_PVT *b));
 __STATIC(void FTree_to_linked_list, (FXYTREE_PVT * t, FXYITEM **ll));
-__STATIC(void free_fxynodes, (FXYTREE_PVT * b, int free_root));
+__STATIC(void free_fxynodes, (FXYTREE * owner, FXYTREE_PVT *b, int free_root));
+__STATIC(void rebalance_fxynodes, (FXYTREE * owner, FXYTREE_PVT **b));
+__STATIC(void fxy_release_node_memory, (FXYTREE * tl));
 __STATIC(void recompute_all_fbbs, (FXYTREE_PVT * p));
+__STATIC(FXYTREE_PVT *build_fxytree_pvt_from_list, (FXYTREE * owner, FXYITEM *ll));
+__STATIC(void count_fxytree, (const FXYTREE_PVT *t, int depth, unsigned int *nNodes, unsigned int *nLeaves, unsigned int *nItems, int *maxDepth));
+__STATIC(unsigned int freeze_fxynode, (FXYFROZEN * fr, const FXYTREE_PVT *t));
+__STATIC(int fxy_ctz, (unsigned int mask));
+__STATIC(void fxycursor_grow, (FXYCURSOR * c));
+__STATIC(int fxynode_out_of_balance, (FXYTREE_PVT * t));
+__STATIC(int rebalance_fxysubtrees, (FXYTREE * owner, FXYTREE_PVT *t));
+__STATIC(FXYJOINBOX *fxyjoin_box_slot, (FXYJOINCTX * ctx, oslong list));
+__STATIC(void fxyjoin_box_put, (FXYJOINCTX * ctx, const FXYJOINSLOT *s));
+__STATIC(void fxyslot_bbox, (FXYJOINCTX * ctx, FXYJOINSLOT *s));
+__STATIC(int fxyjoin_slots, (FXYJOINCTX * ctx, FXYJOINSLOT *a, FXYJOINSLOT *b));
+__STATIC(int fxyjoin_self_slot, (FXYJOINCTX * ctx, FXYJOINSLOT *a));
+__STATIC(double fxynear_d2, (const FXYNEAR *q, double x1, double y1, double x2, double y2));
+__STATIC(void fxynear_push, (FXYNEAR * q, double d2, oslong addr, int kind));
+__STATIC(void fxynear_start, (FXYNEAR * q, const FXYTREE *tree, double x1, double y1, double x2, double y2));
+__STATIC(FXYITEM *fxynear_next, (FXYNEAR * q, double limit2, double *d2));
+__STATIC(unsigned int fxy_morton_spread, (unsigned int v));
+__STATIC(int fxybatch_key_cmp, (const void *a, const void *b));
+__STATIC(void fxybatch_hit, (FXYBATCH * b, int index, FXYITEM *item));
+__STATIC(void fxybatch_list, (FXYBATCH * b, FXYITEM *l, unsigned int mask));
+__STATIC(void fxybatch_node, (FXYBATCH * b, const FXYTREE_PVT *t, unsigned int mask));
+__STATIC(int fxyfrozen_visit_node, (const FXYFROZEN *fr, unsigned int child, double sx1, double sy1, double sx2, double sy2, FXYVISITFN fn, void *arg));
 
 /*
     sdfarea - maintain two dimensional 3-trees representing regions
@@ -100,9 +226,31 @@ __STATIC(void recompute_all_fbbs, (FXYTREE_PVT * p));
     FXYTREE** xy;
         rebalances the tree so that searches proceed efficiently.
 
+    rebalance_fxytree_parallel(xy)
+    FXYTREE** xy;
+        same as rebalance_fxytree, but the subtrees of large nodes are
+        built by parallel tasks (sdfarea_par.cxx). The tree is identical
+        to the one rebalance_fxytree builds.
+
+    rebalance_fxytree_incremental(xy)
+    FXYTREE** xy;
+        rebuilds only the subtrees that have seen many register/unregister
+        calls since they were last built. Cheap when a few areas changed in
+        a big tree. Chunk memory is not compacted, as it is by
+        rebalance_fxytree.
+
+    build_fxytree_bulk(items, n)
+    FXYBULKITEM* items; int n;
+        builds a balanced tree from an array of n areas in one pass. This is
+        the same tree as make_fxytree + register_farea for every item +
+        rebalance_fxytree, without the descent on every insert, the flatten
+        and free of the unbalanced nodes, and the rechunk of the items.
+
     free_fxytree(xy)
     FXYTREE* xy;
-        calls free on all stuff that has been allocated.
+        calls free on all stuff that has been allocated. Tree nodes come
+        from a per-tree arena (reused across rebalances), so this releases
+        them all at once rather than walking the tree.
 
     print_fxytree(fp, xy, n)
     FXYTREE* xy;
@@ -126,6 +274,75 @@ __STATIC(void recompute_all_fbbs, (FXYTREE_PVT * p));
         Don't delete items while searching, since this routine keeps an
         internal pointer of what to look at next.
 
+    freeze_fxytree(xy)
+    FXYTREE* xy;
+        makes a read-only copy of a (rebalanced) tree with all nodes in one
+        array and all leaf items stored contiguously. The copy does not
+        follow later changes to xy. Free it with free_fxyfrozen().
+
+    DB_set_fxyfrozen_search_box(fr, x1, y1, x2, y2)
+    DB_get_next_fxyfrozen_item(handle, ptr)
+    DB_free_fxyfrozen_search_box(handle)
+        same as the DB_*_fxytree_search_box iteration, on a frozen tree.
+        The items returned point into the frozen copy.
+
+    fxytree_cursor_init(c, xy, x1, y1, x2, y2)
+    fxytree_cursor_next(c, ptr)
+    fxytree_cursor_done(c)
+    FXYCURSOR* c; FXYTREE* xy; FXYITEM** ptr;
+        same as the DB_*_fxytree_search_box iteration, but the search state
+        lives in a caller owned cursor (usually on the stack), nothing is
+        allocated unless the tree is very deep, and no subtree is ever
+        dropped. Several threads may search one unchanging tree at once.
+
+    fxytree_visit(xy, x1, y1, x2, y2, fn, arg)
+    fxyfrozen_visit(fr, x1, y1, x2, y2, fn, arg)
+        calls fn(item, arg) for every item in the search area until fn
+        returns TRUE. Returns TRUE if the search was stopped that way.
+
+    fxytree_mem_stats(xy, &stats)
+        reports live items, items on the free list and chunk memory held.
+        Items deleted by unregister_farea are reused by register_farea.
+
+    fxytree_compact(xy)
+        moves the live items into fresh chunk memory and drops the free
+        list, without rebalancing.
+
+    fxytree_stats(xy, &stats)
+        reports depth, leaf sizes, MIDDLE leaf occupancy and the expected
+        cost of a search, to tell when a tree has degenerated.
+
+    make_fxyvtree() / fxyvtree_register / fxyvtree_unregister /
+    fxyvtree_commit / fxyvtree_snapshot / fxysnapshot_release
+        copy-on-write versions of a tree (sdfarea_cow.cxx). The writer path
+        copies instead of changing shared nodes; readers search immutable
+        snapshots without locking.
+
+    fxytree_join(xyA, xyB, expand, fn, arg)
+    fxytree_self_join(xy, expand, fn, arg)
+        calls fn(a, b, arg) for every pair of items whose boxes come within
+        expand of each other, walking both trees together instead of
+        searching one tree once per item of the other.
+
+    fxytree_knn(xy, px, py, k, items, dists)
+        finds the k items nearest to a point, nearest first.
+
+    fxytree_within(xy, x1, y1, x2, y2, dist, &items, &dists)
+        finds all items within dist of a box, nearest first, in malloc'ed
+        arrays. Both prune the tree on node bounding boxes, so they only
+        open nodes that could still hold a closer item.
+
+    fxytree_query_batch(xy, boxes, n, offsets, &items)
+    FXYQUERYBOX* boxes; int* offsets; FXYITEM** items;
+        runs n box searches at once. Nearby boxes share one walk down the
+        tree; the hits of boxes[i] are items[offsets[i]..offsets[i+1]-1].
+
+    fxy_overlap_mask(x1, y1, x2, y2, n, sx1, sy1, sx2, sy2)
+    double *x1, *y1, *x2, *y2; unsigned int n;
+        tests up to 32 boxes against a search box at once and returns a
+        bitmask of the ones that overlap. Frozen tree leaves are scanned
+        with it.
+
     NOTES
         this whole package internally assumes x2 >= x1 and y2 >= y1.
 */
@@ -133,15 +350,128 @@ __STATIC(void recompute_all_fbbs, (FXYTREE_PVT * p));
 #define MEM_PAGE_SIZE_MULTIPLIER 8
 #define SD_MEM_PAGE_SIZE 1024
 
+/*
+    Every tree node is allocated as an FXYNODE, so it can carry bookkeeping
+    that FXYTREE_PVT has no room for. pvt must stay the first member; the
+    rest of the package only sees the FXYTREE_PVT.
+
+    count - items registered below the node
+    built - count when the node was last built by rebalance_fxytree_guts
+    edits - register/unregister calls below the node since then that no
+            rebuild of a subtree has absorbed yet
+    pooled - the node came from its tree's node arena, not from malloc
+    tree - on the root of an FXYTREEX only, that FXYTREEX; NULL elsewhere
+*/
+typedef struct fxynode
+{
+    FXYTREE_PVT pvt;
+    struct fxytreex *tree;
+    int count;
+    int built;
+    int edits;
+    char pooled;
+} FXYNODE;
+
+#define FXYNODE_OF(t) ((FXYNODE *)(t))
+
+/*
+    Likewise every FXYTREE made by make_fxytree and build_fxytree_bulk is
+    allocated as an FXYTREEX, with pub as the first member. Other FXYTREEs
+    exist too (a snapshot's view, trees put together by callers), so a tree
+    handed in through the API is only treated as an FXYTREEX after
+    fxytree_owner has found its root pointing back at it. Those trees get
+    no item free list and malloc'ed nodes, as before the extension.
+
+    freeItems - unregistered items, linked through next, that register_farea
+                hands out again before asking the chunk memory for more
+    nFree     - length of freeItems
+    nLive     - items currently registered
+    itemPageSize - page size itemMemory was made with
+    nodeMemory - chunk memory the tree's nodes are carved from, so that
+                 free_fxytree releases them all at once
+    freeNodes - nodes let go by a rebalance, linked through ptr[LEFT].xy,
+                reused before nodeMemory is asked for more
+    nodeArenas - node memory of other builders (see fxy_node_arena_adopt)
+                 now holding nodes of this tree; released with nodeMemory
+*/
+typedef struct fxytreex
+{
+    FXYTREE pub;
+    FXYITEM *freeItems;
+    int nFree;
+    int nLive;
+    int itemPageSize;
+    void *nodeMemory;
+    FXYTREE_PVT *freeNodes;
+    void **nodeArenas;
+    int nNodeArenas;
+} FXYTREEX;
+
+// Only for trees known to be FXYTREEXs: fxytree_owner's result, or an arena.
+#define FXYTREEX_OF(t) ((FXYTREEX *)(t))
+
+/**
+ * @brief TL if it is an FXYTREEX, NULL for any other tree. Every node is
+ * an FXYNODE (make_fxytree_pvt makes them too), so reading the root's
+ * back pointer stays inside the node whoever made the tree.
+ *
+ * @param tl
+ * @return FXYTREE* the owner to pass to the node and item allocators
+ */
+FXYTREE *fxytree_owner(const FXYTREE *tl)
+{
+    FXYTREE_PVT *root = tl ? tl->fxyTreePvt : NULL;
+
+    if (root == NULL || (const FXYTREE *)FXYNODE_OF(root)->tree != tl)
+        return NULL;
+    return (FXYTREE *)tl;
+}
+
+/*
+    A subtree is rebuilt by rebalance_fxytree_incremental once the edits
+    below it reach a quarter of its size when built (plus a leaf's worth,
+    so small subtrees are not rebuilt on every call). Each rebuild is paid
+    for by the edits that caused it, like a scapegoat tree.
+*/
+#define FXY_REBUILD_EDITS(nd) ((nd)->built / 4 + XY_THRESH)
+
 /*
     make_fxytree() - starts a new tree. X should be a guess about the middle of
         the design, but it is not important provided you do a balance later.
 */
 FXYTREE_PVT *make_fxytree_pvt(double x)
 {
+    return gimme_new_fxynode(NULL, x);
+}
+
+/**
+ * @brief Make an empty node for the tree OWNER, from its free nodes or its
+ * node arena. Nodes that belong to no tree (OWNER NULL) are malloc'ed.
+ *
+ * @param owner
+ * @param x
+ * @return FXYTREE_PVT*
+ */
+static FXYTREE_PVT *gimme_new_fxynode(FXYTREE *owner, double x)
+{
+    FXYTREEX *tx = owner ? FXYTREEX_OF(owner) : NULL;
     FXYTREE_PVT *tl;
 
-    tl = (FXYTREE_PVT *)malloc(sizeof(FXYTREE_PVT));
+    if (tx == NULL)
+        tl = (FXYTREE_PVT *)malloc(sizeof(FXYNODE));
+    else if (tx->freeNodes != NULL)
+    {
+        tl = tx->freeNodes;
+        tx->freeNodes = tl->ptr[LEFT].xy;
+    }
+    else
+        tl = (FXYTREE_PVT *)SY_ChunkCalloc(tx->nodeMemory, 1, sizeof(FXYNODE));
+    ASSERT(tl);
+    FXYNODE_OF(tl)->tree = NULL;
+    FXYNODE_OF(tl)->count = 0;
+    FXYNODE_OF(tl)->built = 0;
+    FXYNODE_OF(tl)->edits = 0;
+    FXYNODE_OF(tl)->pooled = (char)(tx != NULL);
     tl->xsplit = TRUE;
     tl->coord = x;
     tl->ptr[LEFT].al = NULL;
@@ -158,11 +488,31 @@ FXYTREE_PVT *make_fxytree_pvt(double x)
     return (tl);
 }
 
+// Let go of node B. Arena nodes wait on OWNER's free list for reuse.
+static void give_back_fxynode(FXYTREE *owner, FXYTREE_PVT *b)
+{
+    FXYTREEX *tx;
+
+    if (!FXYNODE_OF(b)->pooled)
+    {
+        free((char *)b);
+        return;
+    }
+    if (owner == NULL)
+        return; // released with its arena
+    tx = FXYTREEX_OF(owner);
+    b->ptr[LEFT].xy = tx->freeNodes;
+    tx->freeNodes = b;
+}
+
 FXYTREE *make_fxytree(double x)
 {
-    FXYTREE *tl = (FXYTREE *)calloc(1, sizeof(FXYTREE));
-    tl->fxyTreePvt = make_fxytree_pvt(x);
+    FXYTREE *tl = (FXYTREE *)calloc(1, sizeof(FXYTREEX));
+    FXYTREEX_OF(tl)->nodeMemory = SY_Chunk_Init(MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    tl->fxyTreePvt = gimme_new_fxynode(tl, x);
+    FXYNODE_OF(tl->fxyTreePvt)->tree = FXYTREEX_OF(tl);
     tl->itemMemory = SY_Chunk_Init(MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    FXYTREEX_OF(tl)->itemPageSize = MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE;
     return tl;
 }
 
@@ -171,6 +521,45 @@ static FXYITEM *gimme_new_fxyitem(void *itemMemory)
     return (FXYITEM *)SY_ChunkCalloc(itemMemory, 1, sizeof(FXYITEM));
 }
 
+// Take an item off the tree's free list, or from chunk memory if it is empty.
+static FXYITEM *gimme_fxyitem(FXYTREE *tl)
+{
+    FXYTREE *owner = fxytree_owner(tl);
+    FXYTREEX *tx;
+    FXYITEM *a;
+
+    if (owner == NULL)
+        return gimme_new_fxyitem(tl->itemMemory);
+    tx = FXYTREEX_OF(owner);
+    a = tx->freeItems;
+    if (a == NULL)
+        a = gimme_new_fxyitem(tl->itemMemory);
+    else
+    {
+        tx->freeItems = a->next;
+        tx->nFree--;
+        memset(a, 0, sizeof(FXYITEM));
+    }
+    if (a)
+        tx->nLive++;
+    return a;
+}
+
+// Put an unlinked item on the tree's free list. Other trees leave it in chunk memory.
+static void give_back_fxyitem(FXYTREE *tl, FXYITEM *a)
+{
+    FXYTREE *owner = fxytree_owner(tl);
+    FXYTREEX *tx;
+
+    if (owner == NULL)
+        return;
+    tx = FXYTREEX_OF(owner);
+    a->next = tx->freeItems;
+    tx->freeItems = a;
+    tx->nFree++;
+    tx->nLive--;
+}
+
 void register_farea(
     FXYTREE *tl,
     double x1,
@@ -185,12 +574,11 @@ void register_farea(
     int num; // should be 0, 1, or 2
     FXYTREE_PVT *tree;
 
-    void *itemMemory = t1->itemMemory;
     tree = tl->fxyTreePvt;
 
     FIXFORDER(x1, x2);
     FIXFORDER(y1, y2);
-    a = gimme_new_fxyitem(itemMemory);
+    a = gimme_fxyitem(tl);
 
     a->x1 = x1;
     a->x2 = x2;
@@ -204,6 +592,8 @@ void register_farea(
      */
     for (;; tree = tree->ptr[num].xy) // this for loop searches down the tree
     {
+        FXYNODE_OF(tree)->count++;
+        FXYNODE_OF(tree)->edits++;
         if (x1 < tree->x1)
             tree->x1 = x1; // expand BBOX of tree node
         if (x2 > tree->x2)
@@ -228,7 +618,7 @@ void register_farea(
  * @param tr
  * @return 1 they need to be adjusted
  */
-static int adjust_fbb(FXYTREE_PVT *tr)
+int adjust_fbb(FXYTREE_PVT *tr)
 {
     double x1;
     double y1;
@@ -309,6 +699,7 @@ int unregister_farea(
     FXYITEM *l;
     FXYITEM **tr;
     FXYTREE_PVT **xs;
+    FXYTREE_PVT **xp;
     int num; // should be 0, 1, or 2
     FXYTREE_PVT *xy_stack[100];
 
@@ -324,11 +715,15 @@ int unregister_farea(
     */
     for (;; tree = tree->ptr[num].xy) // this for loop searches down the tree
     {
+        if (xs > &xy_stack[99])
+        {
+            TEXT_out("\nStack too big in unregister_farea\n");
+            exit(2);
+        }
         *xs++ = tree; // make a stack of xytree nodes as we go
         FINDSIDE(tree, x1, y1, x2, y2, num);
         if (tree->is_list[num])
-            ;
-        break;
+            break;
     }
 
     /*
@@ -340,8 +735,9 @@ int unregister_farea(
         if (l->x1 == x1 && l->x2 == x2 && l->y1 == y1 && l->y2 == y2 && l->ud1 == u1 && l->ud2 == u2)
         {
             *tr = l->next;
-            // item remains allocated in chunck memory - it will be cleaned on a
-            // rebalance/rechunk or a free.
+            // the item goes on the free list for the next register_farea;
+            // its chunk memory is released on a rechunk or a free.
+            give_back_fxyitem(tl, l);
             break;
         }
     }
@@ -353,10 +749,10 @@ int unregister_farea(
 #endif
         return FALSE;
     }
-    if (xs > &xy_stack[99])
+    for (xp = &xy_stack[0]; xp < xs; xp++)
     {
-        TEXT_out("\nStack too big in unregister_farea\n");
-        exit(2);
+        FXYNODE_OF(*xp)->count--;
+        FXYNODE_OF(*xp)->edits++;
     }
     for (xs--; xs >= &xy_stack[0]; xs--) /* work way back up the stack*/
     {
@@ -368,8 +764,6 @@ int unregister_farea(
 
 static void free_fxytree_pvt(FXYTREE_PVT *tl)
 {
-    FXYITEM *l;
-    FXYITEM *next;
     int i;
     for (i = 0; i <= 2; i++)
     {
@@ -381,88 +775,222 @@ static void free_fxytree_pvt(FXYTREE_PVT *tl)
         // else if this node was a list we do nothing because
         // the items are all freed from chunk memory later
     }
-    free((char *)tl);
+    if (!FXYNODE_OF(tl)->pooled)
+        free((char *)tl);
 }
 
 void free_fxytree(FXYTREE *tl)
 {
-    free_fxytree_pvt(tl->fxyTreePvt);
+    FXYTREE *owner = fxytree_owner(tl);
+
+    /*
+        Arena nodes go with the arena; the walk frees the malloc'ed ones,
+        which rebalance_fxytree_pvt() makes when given a subtree, and all
+        nodes of a tree that is not an FXYTREEX.
+    */
+    if (tl->fxyTreePvt)
+        free_fxytree_pvt(tl->fxyTreePvt);
+    if (owner)
+        fxy_release_node_memory(owner);
     SY_ChunkFree(tl->itemMemory);
     free(tl);
 }
 
+// Free all node memory of TL, its own and adopted.
+static void fxy_release_node_memory(FXYTREE *tl)
+{
+    FXYTREEX *tx = FXYTREEX_OF(tl);
+    int i;
+
+    for (i = 0; i < tx->nNodeArenas; i++)
+        SY_ChunkFree(tx->nodeArenas[i]);
+    free(tx->nodeArenas);
+    tx->nodeArenas = NULL;
+    tx->nNodeArenas = 0;
+    SY_ChunkFree(tx->nodeMemory);
+    tx->nodeMemory = NULL;
+    tx->freeNodes = NULL;
+}
+
 /**
- * @brief Returns an approximate time required to look something up in a tree
- * of size n. Does a rough approximation of a log by shifting. Always
- * returns at least 1, even for a list of 0 size.
+ * @brief Make an empty owner for nodes built away from their tree, e.g. by
+ * another thread: it has node memory and nothing else. Pass it as the
+ * owner to fxy_split_list / rebalance_fxytree_guts, then hand its nodes to
+ * the real tree with fxy_node_arena_adopt.
  *
- * @param n
- * @return int
+ * @return FXYTREE*
  */
-static int fttl(int n)
+FXYTREE *fxy_node_arena_make(void)
 {
-    int i = 0;
-    do
+    FXYTREE *arena = (FXYTREE *)calloc(1, sizeof(FXYTREEX));
+    FXYTREEX_OF(arena)->nodeMemory = SY_Chunk_Init(MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    return arena;
+}
+
+// Give the node memory of ARENA to TL, and free ARENA.
+void fxy_node_arena_adopt(FXYTREE *tl, FXYTREE *arena)
+{
+    FXYTREEX *tx = FXYTREEX_OF(tl); // tl is an owner, see fxytree_unbuild
+
+    tx->nodeArenas = (void **)realloc(tx->nodeArenas, (tx->nNodeArenas + 1) * sizeof(void *));
+    ASSERT(tx->nodeArenas);
+    tx->nodeArenas[tx->nNodeArenas++] = FXYTREEX_OF(arena)->nodeMemory;
+    free(arena);
+}
+
+// A malloc'ed copy of node T, for path copying (sdfarea_cow.cxx).
+FXYTREE_PVT *fxy_copy_node(const FXYTREE_PVT *t)
+{
+    FXYTREE_PVT *c = (FXYTREE_PVT *)malloc(sizeof(FXYNODE));
+
+    ASSERT(c);
+    *FXYNODE_OF(c) = *FXYNODE_OF(t);
+    FXYNODE_OF(c)->pooled = FALSE;
+    FXYNODE_OF(c)->tree = NULL;
+    return c;
+}
+
+// TRUE if node T lives in a node arena, FALSE if it was malloc'ed.
+int fxy_node_is_pooled(const FXYTREE_PVT *t)
+{
+    return FXYNODE_OF(t)->pooled;
+}
+
+/**
+ * @brief Take the whole tree TL apart for a rebuild from scratch: return
+ * all its items as one linked list and release every node. Node memory is
+ * started over, so rebuilds do not pile up arenas. *OWNER is set to
+ * fxytree_owner(tl) as it was before the root went away; pass it as the
+ * owner of the rebuild.
+ *
+ * @param tl
+ * @param owner
+ * @return FXYITEM*
+ */
+FXYITEM *fxytree_unbuild(FXYTREE *tl, FXYTREE **owner)
+{
+    FXYITEM *ll = NULL;
+
+    *owner = fxytree_owner(tl);
+    FTree_to_linked_list(tl->fxyTreePvt, &ll);
+    free_fxynodes(*owner, tl->fxyTreePvt, TRUE);
+    tl->fxyTreePvt = NULL;
+    if (*owner)
     {
-        i++;
-        n >>= 1;
-    } while (n > 0);
-    return i;
+        fxy_release_node_memory(*owner);
+        FXYTREEX_OF(*owner)->nodeMemory = SY_Chunk_Init(MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    }
+    return ll;
 }
 
 /**
- * @brief Returns an approximate time required to look something up in a
- * tree of size n. Does a rough approximation of a log by shifting. Always
- * returns floor(log2(n))
+ * @brief Find the cheapest cut of the items LL along one axis (x if
+ * XSPLIT). LO..HI is the extent of the items on that axis.
+ *
+ * The midpoint split used to pick between just two cuts with pseudo-log
+ * figures of merit, and degenerated on shapes with many voids: clusters
+ * left most items straddling the midpoint, in a MIDDLE list that every
+ * search scans. Instead, the item edges are binned into FXY_SPLIT_BINS
+ * bins and every bin boundary is tried as a cut. A search the size of an
+ * average item visits a side with probability (side length + item size) /
+ * (node length + item size), while MIDDLE is visited whenever the node is,
+ * so the expected number of items looked at after the cut is
+ *
+ *     cost = middle + (left * P(left) + right * P(right))
+ *
+ * Not splitting costs n, which is where best->cost starts.
  *
+ * @param ll
  * @param n
- * @return int
+ * @param xsplit
+ * @param lo
+ * @param hi
+ * @param best
  */
-static int fttl_fixed(int n)
+static void fxy_best_split(FXYITEM *ll, int n, int xsplit, double lo, double hi, FXYSPLIT *best)
 {
-    int i = 0;
-    while (n)
-        i++, n >>= 1;
-    return i;
+    int ends[FXY_SPLIT_BINS];   // items whose upper edge falls in each bin
+    int starts[FXY_SPLIT_BINS]; // items whose lower edge falls in each bin
+    double w = (hi - lo) / FXY_SPLIT_BINS;
+    double size = 0.0;
+    double cut;
+    double cost;
+    FXYITEM *l;
+    int left;
+    int right;
+    int k;
+
+    best->coord = (lo + hi) / 2;
+    best->cost = (double)n;
+    if (!(w > 0.0))
+        return; // all items at one coordinate, nothing to cut
+
+    memset(ends, 0, sizeof(ends));
+    memset(starts, 0, sizeof(starts));
+    for (l = ll; l != NULL; l = l->next)
+    {
+        double a = xsplit ? l->x1 : l->y1;
+        double z = xsplit ? l->x2 : l->y2;
+
+        size += z - a;
+        k = (int)((z - lo) / w);
+        ends[k < FXY_SPLIT_BINS ? k : FXY_SPLIT_BINS - 1]++;
+        k = (int)((a - lo) / w);
+        starts[k < FXY_SPLIT_BINS ? k : FXY_SPLIT_BINS - 1]++;
+    }
+    size /= n;
+
+    left = 0;  // upper edge below the cut
+    right = n; // lower edge at or above the cut
+    for (k = 1; k < FXY_SPLIT_BINS; k++)
+    {
+        left += ends[k - 1];
+        right -= starts[k - 1];
+        cut = lo + k * w;
+        cost = (n - left - right) +
+               (left * (cut - lo + size) + right * (hi - cut + size)) / (hi - lo + size);
+        if (cost < best->cost)
+        {
+            best->cost = cost;
+            best->coord = cut;
+        }
+    }
 }
 
 /**
- * @brief This routine does the dirty work of rebalancing
- * the tree. It is not directly callable by the user. It is given a
- * linked list of items starting with TL. If the result should be a
- * linked list, what = TRUE and it returns a pointer to the first item in
- * the list. If the result should be a tree, it mallocs the node, and
- * returns a pointer to it with what = FALSE
+ * @brief One step of rebalance_fxytree_guts. Given the linked list of
+ * items LL, decide whether it is worth a node. If not, return NULL and
+ * leave LL alone. If so, take a node from OWNER, deal the items out to its
+ * LEFT, MIDDLE and RIGHT lists and return it; sizes[] gets the length of
+ * each list. Either way *N is the number of items in LL.
  *
- * @param tl
- * @param what
- * @return solong
+ * @param owner
+ * @param ll
+ * @param n
+ * @param sizes
+ * @return FXYTREE_PVT*
  */
-static solong rebalance_fxytree_guts(FXYITEM *tl, char *what)
+FXYTREE_PVT *fxy_split_list(FXYTREE *owner, FXYITEM *ll, int *n, int sizes[3])
 {
     double llx = (double)DBL_MAX;
     double lly = (double)DBL_MAX;
     double urx = (double)-DBL_MAX;
     double ury = (double)-DBL_MAX;
-    int n = 0;      // number of items in linked list
     FXYTREE_PVT *b; // pointer to new tree node, if needed
-    double xmid;
-    double ymid;
-    int x1;
-    int y1;
-    int x2;
-    int y2;
-    FXYITEM *ll = tl;
+    FXYSPLIT xs;
+    FXYSPLIT ys; // best cuts in x and y
+    double coord;
+    int xsplit;
+    int sides; // items that go LEFT or RIGHT of the chosen cut
+    int num;
     FXYITEM *l;
     FXYITEM *next;
-    int i;
-    int fom_x;
-    int fom_y; // figures of merit for splitting x or y
 
     // Count the items in the linked list, and compute bounds.
+    *n = 0;
     for (l = ll; l != NULL; l = l->next)
     {
-        n++;
+        (*n)++;
         if (l->x1 < llx)
             llx = l->x1;
         if (l->x2 > urx)
@@ -473,120 +1001,84 @@ static solong rebalance_fxytree_guts(FXYITEM *tl, char *what)
             ury = l->y2;
     }
 
-    // If too few items, return a simple linked list
-    if (n < XY_THRESH)
-        RETURN_LL;
+    // If too few items, keep a simple linked list
+    if (*n < XY_THRESH)
+        return NULL;
 
-    // Compute potential x and y splits
-    xmid = (llx + urx) / 2;
-    ymid = (lly + ury) / 2;
+    // Pick the cheaper of the best x and best y cut
+    fxy_best_split(ll, *n, TRUE, llx, urx, &xs);
+    fxy_best_split(ll, *n, FALSE, lly, ury, &ys);
+    xsplit = xs.cost <= ys.cost;
+    coord = xsplit ? xs.coord : ys.coord;
 
-    x1 = x2 = y1 = y2 = 0;
+    // Not worth a node unless enough items leave the middle
+    sides = 0;
     for (l = ll; l != NULL; l = l->next)
     {
-        if (l->x2 < xmid)
-            x1++;
-        if (l->x1 > xmid)
-            x2++;
-        if (l->y2 < ymid)
-            y1++;
-        if (l->y1 > ymid)
-            y2++;
+        if (xsplit ? (l->x2 < coord || l->x1 > coord) : (l->y2 < coord || l->y1 > coord))
+            sides++;
     }
+    if (sides < XY_THRESHOLD)
+        return NULL;
 
-    /*
-        Pick the better split. A split is good if the two sides are balanced
-        and there are few things in the middle. Since all things are either
-        on one side or in the middle, N-X1-X2 counts the number in the middle.
-        the expected search time is x1*log(x1)+x2*log(x2)+xm*log(xm). We use
-        pseudo logs = number of shifts till we get 0.
-        fom = figure_of_merit (we want the lowest)
-        fttl = time to lookup. roughly log(x), base 2, but fttl(0) == 1.
-        note - the middle should count more, since we have to search
-        it more often (in fact on every search) hence we use n as the multiplier,
-        not(n-x1-x2) as you might expect.
-
-        fom_x = x1 * fttl(x1) + n*fttl(n-x1-x2) + x2*fttl(x2);
-        fom_y = y1 * fttl(y1) + n*fttl(n-y1-y2) + y2*fttl(y2);
-
-        Above formula degenerated at multiple voids shape, we need to avoid a node which
-        stored thousands of elements.
-    */
-    fom_x = x1 * fttl_fixed(x1) + n * fttl_fixed(n - x1 - x2) + x2 * fttl_fixed(x2);
-    fom_y = y1 * fttl_fixed(y1) + n * fttl_fixed(n - y1 - y2) + y2 * fttl_fixed(y2);
+    b = gimme_new_fxynode(owner, (double)0.0);
+    b->xsplit = (char)xsplit;
+    b->coord = coord;
 
-    if (fom_x <= fom_y)
+    sizes[LEFT] = sizes[MIDDLE] = sizes[RIGHT] = 0;
+    for (l = ll; l != NULL; l = next)
     {
-        if (x1 + x2 < XY_THRESHOLD)
-            RETURN_LL;
-
-        b = make_fxytree_pvt((double)0.0);
-        b->xsplit = TRUE;
-        b->coord = xmid;
-
-        for (l = ll; l != NULL; l = next)
-        {
-            next = l->next;
-            if (l->x2 < xmid)
-            {
-                l->next = b->ptr[LEFT].al;
-                b->ptr[LEFT].al = l;
-            }
-            else if (l->x1 > xmid)
-            {
-                l->next = b->ptr[RIGHT].al;
-                b->ptr[RIGHT].al = l;
-            }
-            else
-            {
-                l->next = b->ptr[MIDDLE].al;
-                b->ptr[MIDDLE].al = l;
-            }
-        }
+        next = l->next;
+        FINDSIDE(b, l->x1, l->y1, l->x2, l->y2, num);
+        l->next = b->ptr[num].al;
+        b->ptr[num].al = l;
+        sizes[num]++;
     }
-    else // split in the Y direction
-    {
-        if (y1 + y2 < XY_THRESHOLD)
-            RETURN_LL;
+    return b;
+}
 
-        b = make_fxytree_pvt((double)0.0)
-                b->xsplit = FALSE;
-        b->coord = ymid;
+/**
+ * @brief This routine does the dirty work of rebalancing
+ * the tree. It is not directly callable by the user. It is given a
+ * linked list of items starting with TL. If the result should be a
+ * linked list, what = TRUE and it returns a pointer to the first item in
+ * the list. If the result should be a tree, it makes the node, and
+ * returns a pointer to it with what = FALSE. Nodes are taken from the tree
+ * OWNER, or malloc'ed if OWNER is NULL (see gimme_new_fxynode).
+ *
+ * @param owner
+ * @param tl
+ * @param what
+ * @return solong
+ */
+solong rebalance_fxytree_guts(FXYTREE *owner, FXYITEM *tl, char *what)
+{
+    FXYTREE_PVT *b;
+    int sizes[3];
+    int n;
+    int i;
 
-        for (l = ll; l != NULL; l = next)
-        {
-            next = l->next;
-            if (l->y2 < ymid)
-            {
-                l->next = b->ptr[LEFT].al;
-                b->ptr[LEFT].al = l;
-            }
-            else if (l->y1 > ymid)
-            {
-                l->next = b->ptr[RIGHT].al;
-                b->ptr[RIGHT].al = l;
-            }
-            else
-            {
-                l->next = b->ptr[MIDLLE].al;
-                b->ptr[MIDDLE].al = l;
-            }
-        }
+    b = fxy_split_list(owner, tl, &n, sizes);
+    if (b == NULL)
+    {
+        *what = TRUE;
+        return (oslong)tl;
     }
 
     // Now rebalance the subtrees
     for (i = LEFT; i <= RIGHT; i++)
     {
-        b->ptr[i].xy = (FXYTREE_PVT *)rebalance_fxytree_guts(b->ptr[i].al, &(b->is_list[i]));
+        b->ptr[i].xy = (FXYTREE_PVT *)rebalance_fxytree_guts(owner, b->ptr[i].al, &(b->is_list[i]));
     }
+    fxynode_set_built(b, n);
     *what = FALSE;
     return ((oslong)b);
 }
 
 // Take the tree pointed to by T, and add it to the linked list at ll
-static void FTree_to_linked_list(FXYTREE_PVT *t, FXYTREE_PVT *t, FXYITEM **ll)
+static void FTree_to_linked_list(FXYTREE_PVT *t, FXYITEM **ll)
 {
-    FXYItem *l;
+    FXYITEM *l;
     FXYITEM *next;
     int i;
 
@@ -598,7 +1090,7 @@ static void FTree_to_linked_list(FXYTREE_PVT *t, FXYTREE_PVT *t, FXYITEM **ll)
             {
                 next = l->next;
                 l->next = *ll;
-                *ll = ll
+                *ll = l;
             }
         }
         else
@@ -608,20 +1100,22 @@ static void FTree_to_linked_list(FXYTREE_PVT *t, FXYTREE_PVT *t, FXYITEM **ll)
 
 /**
  * @brief Free the XY nodes of the tree. If FREE_ROOT, free the root node.
+ * Arena nodes go back to OWNER for reuse.
  *
+ * @param owner
  * @param b
  * @param free_root
  */
-static void free_fxynodes(FXYTREE_PVT *b, int free_root)
+static void free_fxynodes(FXYTREE *owner, FXYTREE_PVT *b, int free_root)
 {
     int i;
     for (i = LEFT; i <= RIGHT; i++)
     {
         if (!b->is_list[i])
-            free_fxynodes(b->ptr[i].xy, TRUE);
+            free_fxynodes(owner, b->ptr[i].xy, TRUE);
     }
     if (free_root)
-        free((char *)b);
+        give_back_fxynode(owner, b);
 }
 
 static void recompute_all_fbbs(FXYTREE_PVT *p)
@@ -645,32 +1139,160 @@ static void recompute_all_fbbs(FXYTREE_PVT *p)
  */
 void rebalance_fxytree_pvt(FXYTREE_PVT **b)
 {
-    FXYTREE *ll = NULL;
-    char what;
-    oslong temp;
+    FXYTREEX *tx = *b ? FXYNODE_OF(*b)->tree : NULL;
+
+    // the root of an FXYTREEX is rebuilt from and into that tree's arena
+    rebalance_fxynodes(tx && tx->pub.fxyTreePvt == *b ? &tx->pub : NULL, b);
+}
+
+/**
+ * @brief Rebuild the nodes of *B, which belong to the tree OWNER (NULL for
+ * malloc'ed nodes).
+ *
+ * @param owner
+ * @param b
+ */
+static void rebalance_fxynodes(FXYTREE *owner, FXYTREE_PVT **b)
+{
+    FXYITEM *ll = NULL;
 
     // First, turn the tree into a linked list
     FTree_to_linked_list(*b, &ll);
 
     // Then free the tree structure
-    free_fxynodes(*b, TRUE /* TRUE means to free the root node */);
+    free_fxynodes(owner, *b, TRUE /* TRUE means to free the root node */);
 
     // Then rebalance the tree
-    temp = rebalance_fxytree_guts(ll, &what);
+    *b = build_fxytree_pvt_from_list(owner, ll);
+}
+
+/**
+ * @brief Build balanced tree nodes over the linked list of items LL and
+ * fix up the bounding boxes. Always returns a node, even when the items
+ * are too few to split.
+ *
+ * @param owner
+ * @param ll
+ * @return FXYTREE_PVT*
+ */
+static FXYTREE_PVT *build_fxytree_pvt_from_list(FXYTREE *owner, FXYITEM *ll)
+{
+    char what;
+    oslong temp;
+
+    temp = rebalance_fxytree_guts(owner, ll, &what);
+    return fxy_root_from_subtree(owner, temp, what);
+}
+
+/**
+ * @brief Turn the result of rebalance_fxytree_guts (a node, or a list if
+ * WHAT) into the root node of OWNER (no tree if NULL) and fix up the
+ * bounding boxes.
+ *
+ * @param owner
+ * @param temp
+ * @param what
+ * @return FXYTREE_PVT*
+ */
+FXYTREE_PVT *fxy_root_from_subtree(FXYTREE *owner, oslong temp, char what)
+{
+    FXYTREE_PVT *b;
+    FXYITEM *l;
+    int n = 0;
 
     if (what == FALSE)
     {
         // A tree was returned
-        *b = (FXYTREE_PVT *)temp;
+        b = (FXYTREE_PVT *)temp;
     }
     else
     {
         // A linked list was returned. Make a fake node.
-        *b = make_fxytree_pvt((double)-DBL_MAX);
-        (*b)->ptr[RIGHT].al = (FXYITEM *)temp;
+        b = gimme_new_fxynode(owner, (double)-DBL_MAX);
+        b->ptr[RIGHT].al = (FXYITEM *)temp;
+        for (l = b->ptr[RIGHT].al; l != NULL; l = l->next)
+            n++;
+        fxynode_set_built(b, n);
+    }
+
+    if (owner)
+        FXYNODE_OF(b)->tree = FXYTREEX_OF(owner);
+    recompute_all_fbbs(b);
+    return b;
+}
+
+// Record that node T was just built over N items.
+void fxynode_set_built(FXYTREE_PVT *t, int n)
+{
+    FXYNODE_OF(t)->count = n;
+    FXYNODE_OF(t)->built = n;
+    FXYNODE_OF(t)->edits = 0;
+}
+
+static int fxynode_out_of_balance(FXYTREE_PVT *t)
+{
+    FXYNODE *nd = FXYNODE_OF(t);
+    return nd->edits >= FXY_REBUILD_EDITS(nd);
+}
+
+/**
+ * @brief Rebuild the children of T that are out of balance, and look
+ * further down in the ones that are not. A child that has become too
+ * small for a node turns back into a list. Returns the number of edits
+ * absorbed by the rebuilds, which are also taken off T's own edits, so
+ * that T is only rebuilt for changes nothing below it has fixed.
+ *
+ * @param owner
+ * @param t
+ * @return int
+ */
+static int rebalance_fxysubtrees(FXYTREE *owner, FXYTREE_PVT *t)
+{
+    FXYTREE_PVT *c;
+    FXYITEM *ll;
+    int absorbed = 0;
+    int i;
+
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (t->is_list[i])
+            continue;
+
+        c = t->ptr[i].xy;
+        if (fxynode_out_of_balance(c))
+        {
+            absorbed += FXYNODE_OF(c)->edits;
+            ll = NULL;
+            FTree_to_linked_list(c, &ll);
+            free_fxynodes(owner, c, TRUE);
+            t->ptr[i].xy = (FXYTREE_PVT *)rebalance_fxytree_guts(owner, ll, &(t->is_list[i]));
+            if (!t->is_list[i])
+                recompute_all_fbbs(t->ptr[i].xy);
+        }
+        else
+            absorbed += rebalance_fxysubtrees(owner, c);
     }
+    FXYNODE_OF(t)->edits -= absorbed;
+    return absorbed;
+}
+
+/**
+ * @brief Rebalance only the parts of the tree that changed a lot since they
+ * were built. The whole tree is rebuilt only when the root itself is out
+ * of balance. Items are not moved to new chunk memory; use
+ * rebalance_fxytree for that.
+ *
+ * @param b
+ */
+void rebalance_fxytree_incremental(FXYTREE **b)
+{
+    FXYTREE_PVT *root = (*b)->fxyTreePvt;
+    FXYTREE *owner = fxytree_owner(*b);
 
-    recompute_all_fbbs(*b);
+    if (fxynode_out_of_balance(root))
+        rebalance_fxynodes(owner, &((*b)->fxyTreePvt));
+    else
+        (void)rebalance_fxysubtrees(owner, root);
 }
 
 static void rechunk_fxytree(FXYTREE_PVT *b, void *itemMemory)
@@ -715,19 +1337,174 @@ static void rechunk_fxytree(FXYTREE_PVT *b, void *itemMemory)
 void rebalance_fxytree(FXYTREE **b)
 {
     FXYTREE *x = *b;
-    void *itemMemory;
-    SY_MemHeadPtr memPtr = (SY_MemHeadPtr)x->itemMemory;
-    int memPages = memPtr->memPages;
+    FXYTREE *owner;
+    FXYITEM *ll;
 
     // this should return a status below // this function not checking lots of things it should
-    rebalance_fxytree_pvt(&((*b)->fxyTreePvt));
-    if (memPages > 1)
-    {
-        itemMemory = SY_Chunk_Init(memPages * MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    ll = fxytree_unbuild(x, &owner);
+    x->fxyTreePvt = build_fxytree_pvt_from_list(owner, ll);
+    fxy_rechunk_items(x);
+}
+
+/**
+ * @brief After a full rebalance, move the items into one fresh block of
+ * chunk memory if they have spread over several pages.
+ *
+ * @param x
+ */
+void fxy_rechunk_items(FXYTREE *x)
+{
+    void *itemMemory;
+    SY_MemHeadPtr memPtr = (SY_MemHeadPtr)x->itemMemory;
+    int memPages = memPtr->memPages;
+
+    if (memPages > 1)
+    {
+        itemMemory = SY_Chunk_Init(memPages * MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
         rechunk_fxytree(x->fxyTreePvt, itemMemory);
         SY_ChunkFree(x->itemMemory);
         x->itemMemory = itemMemory;
+        // the free items lived in the old chunk memory
+        if (fxytree_owner(x))
+        {
+            FXYTREEX_OF(x)->freeItems = NULL;
+            FXYTREEX_OF(x)->nFree = 0;
+            FXYTREEX_OF(x)->itemPageSize = memPages * MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE;
+        }
+    }
+}
+
+/**
+ * @brief Report how much memory a tree holds and how much of it is
+ * waiting on the free list. A tree that is not an FXYTREEX has its items
+ * counted, no free list, malloc'ed nodes and item pages of the standard
+ * size.
+ *
+ * @param tl
+ * @param stats
+ */
+void fxytree_mem_stats(const FXYTREE *tl, FXYMEMSTATS *stats)
+{
+    SY_MemHeadPtr memPtr = (SY_MemHeadPtr)tl->itemMemory;
+    FXYTREE *owner = fxytree_owner(tl);
+    int pageSize = MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE;
+
+    stats->memPages = memPtr ? memPtr->memPages : 0;
+    if (owner)
+    {
+        FXYTREEX *tx = FXYTREEX_OF(owner);
+        int i;
+
+        stats->liveItems = tx->nLive;
+        stats->freeItems = tx->nFree;
+        stats->nodePages = ((SY_MemHeadPtr)tx->nodeMemory)->memPages;
+        for (i = 0; i < tx->nNodeArenas; i++)
+            stats->nodePages += ((SY_MemHeadPtr)tx->nodeArenas[i])->memPages;
+        // node chunks only ever get standard pages
+        stats->bytes = (double)stats->memPages * tx->itemPageSize + (double)stats->nodePages * pageSize;
+    }
+    else
+    {
+        unsigned int nNodes = 0, nLeaves = 0, nItems = 0;
+        int depth = 0;
+
+        if (tl->fxyTreePvt)
+            count_fxytree(tl->fxyTreePvt, 1, &nNodes, &nLeaves, &nItems, &depth);
+        stats->liveItems = (int)nItems;
+        stats->freeItems = 0;
+        stats->nodePages = 0;
+        stats->bytes = (double)stats->memPages * pageSize + (double)nNodes * sizeof(FXYNODE);
+    }
+}
+
+/**
+ * @brief Copy the live items into fresh chunk memory sized for them and
+ * release the old memory, free list included. The tree shape is left
+ * alone, so this is cheaper than rebalance_fxytree and can run whenever
+ * the editor is idle.
+ *
+ * @param tl
+ */
+void fxytree_compact(FXYTREE *tl)
+{
+    FXYTREE *owner = fxytree_owner(tl);
+    FXYMEMSTATS ms;
+    void *itemMemory;
+    int pageSize = MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE;
+
+    fxytree_mem_stats(tl, &ms);
+    if (ms.freeItems == 0 && ms.memPages <= 1)
+        return; // nothing to gain
+
+    if (ms.liveItems * (int)sizeof(FXYITEM) > pageSize)
+        pageSize = ms.liveItems * (int)sizeof(FXYITEM);
+    itemMemory = SY_Chunk_Init(pageSize, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    rechunk_fxytree(tl->fxyTreePvt, itemMemory);
+    SY_ChunkFree(tl->itemMemory);
+    tl->itemMemory = itemMemory;
+    if (owner)
+    {
+        FXYTREEX_OF(owner)->freeItems = NULL;
+        FXYTREEX_OF(owner)->nFree = 0;
+        FXYTREEX_OF(owner)->itemPageSize = pageSize;
+    }
+}
+
+/**
+ * @brief Build a balanced tree from an array of areas in one pass. The
+ * items are copied into a single chunk page in array order, linked, and
+ * handed straight to rebalance_fxytree_guts. Use this instead of
+ * register_farea + rebalance_fxytree when all the areas are known up front.
+ *
+ * @param items
+ * @param n
+ * @return FXYTREE*
+ */
+FXYTREE *build_fxytree_bulk(const FXYBULKITEM *items, int n)
+{
+    FXYTREE *tl;
+    FXYITEM *ll = NULL;
+    FXYITEM *a;
+    double x1, y1, x2, y2;
+    int pageSize = MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE;
+    int i;
+
+    if (n < 0)
+        n = 0;
+
+    // one page large enough for all items, so they end up contiguous
+    if (n * (int)sizeof(FXYITEM) > pageSize)
+        pageSize = n * (int)sizeof(FXYITEM);
+
+    tl = (FXYTREE *)calloc(1, sizeof(FXYTREEX));
+    FXYTREEX_OF(tl)->nLive = n;
+    FXYTREEX_OF(tl)->nodeMemory = SY_Chunk_Init(MEM_PAGE_SIZE_MULTIPLIER * SD_MEM_PAGE_SIZE, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    tl->itemMemory = SY_Chunk_Init(pageSize, SYCHUNK_ALIGN, SYCHUNK_MALLOC);
+    FXYTREEX_OF(tl)->itemPageSize = pageSize;
+
+    // link back to front so the list keeps array order
+    for (i = n - 1; i >= 0; i--)
+    {
+        x1 = items[i].x1;
+        y1 = items[i].y1;
+        x2 = items[i].x2;
+        y2 = items[i].y2;
+        FIXFORDER(x1, x2);
+        FIXFORDER(y1, y2);
+
+        a = gimme_new_fxyitem(tl->itemMemory);
+        a->x1 = x1;
+        a->y1 = y1;
+        a->x2 = x2;
+        a->y2 = y2;
+        a->ud1 = items[i].ud1;
+        a->ud2 = items[i].ud2;
+        a->next = ll;
+        ll = a;
     }
+
+    tl->fxyTreePvt = build_fxytree_pvt_from_list(tl, ll);
+    return tl;
 }
 
 void DB_min_fxytree_search_box(void *handle, double min_x, double min_y, double max_x, double max_y)
@@ -824,7 +1601,7 @@ void *DB_set_fxytree_search_box(FXYTREE *ptr,
 
     search = (SDAreaSearch *)malloc(sizeof(SDAreaSearch));
 
-    FIXFORDER(x1, x1);
+    FIXFORDER(x1, x2);
     FIXFORDER(y1, y2);
 
     search->sx1 = x1;
@@ -868,6 +1645,1245 @@ void DB_free_fxytree_search_box(void *handle)
     SYFree(handle);
 }
 
+/*
+    The frozen tree search keeps its own stack of child indices. A node
+    pushes at most three children and pops itself, so 2 * depth + 1 entries
+    are always enough and nothing is ever dropped.
+*/
+typedef struct fxyfrozen_search
+{
+    const FXYFROZEN *fr;
+    double sx1, sy1, sx2, sy2;
+    unsigned int cur;  // next item to test in the current leaf
+    unsigned int end;  // one past the last item of the current leaf
+    unsigned int base; // item index of bit 0 of mask
+    unsigned int mask; // hits of the last block not yet returned
+    int tos;          // top of stack, -1 when empty
+    unsigned int stack[1];
+} FXYFROZEN_SEARCH;
+
+// Count the nodes, leaves and items below T, and the depth of the tree.
+static void count_fxytree(const FXYTREE_PVT *t, int depth,
+                          unsigned int *nNodes, unsigned int *nLeaves,
+                          unsigned int *nItems, int *maxDepth)
+{
+    FXYITEM *l;
+    int i;
+
+    (*nNodes)++;
+    if (depth > *maxDepth)
+        *maxDepth = depth;
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (t->is_list[i])
+        {
+            if (t->ptr[i].al == NULL)
+                continue;
+            (*nLeaves)++;
+            for (l = t->ptr[i].al; l != NULL; l = l->next)
+                (*nItems)++;
+        }
+        else
+            count_fxytree(t->ptr[i].xy, depth + 1, nNodes, nLeaves, nItems, maxDepth);
+    }
+}
+
+// Copy the node T and everything below it into FR. Returns the node index.
+static unsigned int freeze_fxynode(FXYFROZEN *fr, const FXYTREE_PVT *t)
+{
+    unsigned int index = fr->nNodes++;
+    FXYFROZEN_NODE *n = &fr->nodes[index];
+    FXYFROZEN_LEAF_RANGE *lr;
+    FXYITEM *l;
+    unsigned int child;
+    int i;
+
+    n->x1 = t->x1;
+    n->y1 = t->y1;
+    n->x2 = t->x2;
+    n->y2 = t->y2;
+    n->coord = t->coord;
+    n->xsplit = t->xsplit;
+
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (t->is_list[i])
+        {
+            if (t->ptr[i].al == NULL)
+            {
+                child = FXYFROZEN_EMPTY;
+            }
+            else
+            {
+                child = fr->nLeaves++;
+                lr = &fr->leaves[child];
+                lr->first = fr->nItems;
+                for (l = t->ptr[i].al; l != NULL; l = l->next)
+                {
+                    fr->items[fr->nItems] = *l;
+                    fr->items[fr->nItems].next = NULL;
+                    fr->bx1[fr->nItems] = l->x1;
+                    fr->by1[fr->nItems] = l->y1;
+                    fr->bx2[fr->nItems] = l->x2;
+                    fr->by2[fr->nItems] = l->y2;
+                    fr->nItems++;
+                }
+                lr->count = fr->nItems - lr->first;
+                child |= FXYFROZEN_LEAF;
+            }
+        }
+        else
+            child = freeze_fxynode(fr, t->ptr[i].xy);
+        n->child[i] = child;
+    }
+    return index;
+}
+
+/**
+ * @brief Make a read-only copy of the tree in flat arrays. Meant to be
+ * called after rebalance_fxytree, once a tree is only searched. The copy
+ * does not follow later register/unregister calls on TL.
+ *
+ * @param tl
+ * @return FXYFROZEN*
+ */
+FXYFROZEN *freeze_fxytree(const FXYTREE *tl)
+{
+    FXYFROZEN *fr;
+    unsigned int nNodes = 0;
+    unsigned int nLeaves = 0;
+    unsigned int nItems = 0;
+    int depth = 0;
+
+    count_fxytree(tl->fxyTreePvt, 1, &nNodes, &nLeaves, &nItems, &depth);
+
+    fr = (FXYFROZEN *)calloc(1, sizeof(FXYFROZEN));
+    fr->nodes = (FXYFROZEN_NODE *)malloc(nNodes * sizeof(FXYFROZEN_NODE));
+    fr->leaves = (FXYFROZEN_LEAF_RANGE *)malloc((nLeaves ? nLeaves : 1) * sizeof(FXYFROZEN_LEAF_RANGE));
+    fr->items = (FXYITEM *)malloc((nItems ? nItems : 1) * sizeof(FXYITEM));
+    fr->bx1 = (double *)malloc((nItems ? nItems : 1) * 4 * sizeof(double));
+    fr->by1 = fr->bx1 + nItems;
+    fr->bx2 = fr->by1 + nItems;
+    fr->by2 = fr->bx2 + nItems;
+    fr->depth = depth;
+
+    (void)freeze_fxynode(fr, tl->fxyTreePvt);
+    ASSERT(fr->nNodes == nNodes && fr->nLeaves == nLeaves && fr->nItems == nItems);
+    return fr;
+}
+
+void free_fxyfrozen(FXYFROZEN *fr)
+{
+    if (!fr)
+        return;
+    free(fr->nodes);
+    free(fr->leaves);
+    free(fr->items);
+    free(fr->bx1); // by1, bx2 and by2 share this block
+    free(fr);
+}
+
+void *DB_set_fxyfrozen_search_box(const FXYFROZEN *fr,
+                                  double x1, double y1, double x2, double y2)
+{
+    FXYFROZEN_SEARCH *search;
+
+    search = (FXYFROZEN_SEARCH *)malloc(sizeof(FXYFROZEN_SEARCH) +
+                                        (2 * fr->depth + 1) * sizeof(unsigned int));
+
+    FIXFORDER(x1, x2);
+    FIXFORDER(y1, y2);
+
+    search->fr = fr;
+    search->sx1 = x1;
+    search->sy1 = y1;
+    search->sx2 = x2;
+    search->sy2 = y2;
+    search->cur = search->end = 0;
+    search->base = search->mask = 0;
+    search->tos = 0;
+    search->stack[0] = 0; // the root is always node 0
+    return (void *)search;
+}
+
+// Returns TRUE if it found something else, FALSE if not
+int DB_get_next_fxyfrozen_item(void *handle, FXYITEM **ptr)
+{
+    FXYFROZEN_SEARCH *search = (FXYFROZEN_SEARCH *)handle;
+    const FXYFROZEN *fr = search->fr;
+    double sx1 = search->sx1;
+    double sy1 = search->sy1;
+    double sx2 = search->sx2;
+    double sy2 = search->sy2;
+
+    ASSERT(handle);
+
+    for (;;)
+    {
+        // hand out the hits of the last block, then test the next block
+        if (search->mask)
+        {
+            int bit = fxy_ctz(search->mask);
+            search->mask &= search->mask - 1;
+            *ptr = &fr->items[search->base + bit];
+            return TRUE;
+        }
+        if (search->cur < search->end)
+        {
+            unsigned int n = search->end - search->cur;
+            if (n > FXY_SCAN_BLOCK)
+                n = FXY_SCAN_BLOCK;
+            search->base = search->cur;
+            search->mask = fxy_overlap_mask(fr->bx1 + search->cur, fr->by1 + search->cur,
+                                            fr->bx2 + search->cur, fr->by2 + search->cur,
+                                            n, sx1, sy1, sx2, sy2);
+            search->cur += n;
+            continue;
+        }
+
+        if (search->tos < 0)
+            return FALSE;
+
+        {
+            unsigned int child = search->stack[search->tos--];
+            const FXYFROZEN_NODE *t;
+            int s;
+
+            if (child & FXYFROZEN_LEAF)
+            {
+                const FXYFROZEN_LEAF_RANGE *lr = &fr->leaves[child & ~FXYFROZEN_LEAF];
+                search->cur = lr->first;
+                search->end = lr->first + lr->count;
+                continue;
+            }
+
+            t = &fr->nodes[child];
+            if (DISJOINT(sx1, sy1, sx2, sy2, t)) // check search area against
+                continue;                        // bbox of stuff in tree
+
+            FINDSIDE(t, sx1, sy1, sx2, sy2, s);
+            if (s != RIGHT && t->child[LEFT] != FXYFROZEN_EMPTY)
+                search->stack[++search->tos] = t->child[LEFT];
+            if (s != LEFT && t->child[RIGHT] != FXYFROZEN_EMPTY)
+                search->stack[++search->tos] = t->child[RIGHT];
+            if (t->child[MIDDLE] != FXYFROZEN_EMPTY)
+                search->stack[++search->tos] = t->child[MIDDLE];
+        }
+    }
+}
+
+void DB_free_fxyfrozen_search_box(void *handle)
+{
+    free(handle);
+}
+
+// Index of the lowest set bit. MASK must not be 0.
+static int fxy_ctz(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1))
+        i++, mask >>= 1;
+    return i;
+#endif
+}
+
+/**
+ * @brief Test N (at most FXY_SCAN_BLOCK) boxes against the search box and
+ * return a bitmask of the ones that are not DISJOINT from it. The vector
+ * paths use "not greater" / "not less" compares, so the bits are the same
+ * as the scalar DISJOINT test, including for NaN coordinates.
+ *
+ * @return unsigned int
+ */
+unsigned int fxy_overlap_mask(const double *x1, const double *y1,
+                              const double *x2, const double *y2,
+                              unsigned int n,
+                              double sx1, double sy1, double sx2, double sy2)
+{
+    unsigned int mask = 0;
+    unsigned int i = 0;
+
+    ASSERT(n <= FXY_SCAN_BLOCK);
+
+#if defined(__AVX__)
+    {
+        __m256d vsx1 = _mm256_set1_pd(sx1);
+        __m256d vsy1 = _mm256_set1_pd(sy1);
+        __m256d vsx2 = _mm256_set1_pd(sx2);
+        __m256d vsy2 = _mm256_set1_pd(sy2);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256d hit;
+            hit = _mm256_cmp_pd(_mm256_loadu_pd(x1 + i), vsx2, _CMP_NGT_UQ); // !(sx2 < x1)
+            hit = _mm256_and_pd(hit, _mm256_cmp_pd(_mm256_loadu_pd(x2 + i), vsx1, _CMP_NLT_UQ));
+            hit = _mm256_and_pd(hit, _mm256_cmp_pd(_mm256_loadu_pd(y1 + i), vsy2, _CMP_NGT_UQ));
+            hit = _mm256_and_pd(hit, _mm256_cmp_pd(_mm256_loadu_pd(y2 + i), vsy1, _CMP_NLT_UQ));
+            mask |= (unsigned int)_mm256_movemask_pd(hit) << i;
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    {
+        __m128d vsx1 = _mm_set1_pd(sx1);
+        __m128d vsy1 = _mm_set1_pd(sy1);
+        __m128d vsx2 = _mm_set1_pd(sx2);
+        __m128d vsy2 = _mm_set1_pd(sy2);
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128d hit;
+            hit = _mm_cmpngt_pd(_mm_loadu_pd(x1 + i), vsx2); // !(sx2 < x1)
+            hit = _mm_and_pd(hit, _mm_cmpnlt_pd(_mm_loadu_pd(x2 + i), vsx1));
+            hit = _mm_and_pd(hit, _mm_cmpngt_pd(_mm_loadu_pd(y1 + i), vsy2));
+            hit = _mm_and_pd(hit, _mm_cmpnlt_pd(_mm_loadu_pd(y2 + i), vsy1));
+            mask |= (unsigned int)_mm_movemask_pd(hit) << i;
+        }
+    }
+#endif
+
+    // what is left over, or everything without vector support
+    for (; i < n; i++)
+    {
+        if (!(sx2 < x1[i] || sx1 > x2[i] || sy2 < y1[i] || sy1 > y2[i]))
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+void fxytree_cursor_init(FXYCURSOR *c, const FXYTREE *tl,
+                         double x1, double y1, double x2, double y2)
+{
+    FIXFORDER(x1, x2);
+    FIXFORDER(y1, y2);
+
+    c->sx1 = x1;
+    c->sy1 = y1;
+    c->sx2 = x2;
+    c->sy2 = y2;
+    c->stack = c->inlineStack;
+    c->size = FXYCURSOR_INLINE_DEPTH;
+    c->tos = 0;
+    c->stack[0].addr = (oslong)tl->fxyTreePvt;
+    c->stack[0].is_list = FALSE;
+}
+
+// Double the cursor stack. The inline stack is copied, never freed.
+static void fxycursor_grow(FXYCURSOR *c)
+{
+    struct fsearch_item *stack;
+
+    stack = (struct fsearch_item *)malloc(2 * c->size * sizeof(struct fsearch_item));
+    memcpy(stack, c->stack, (c->tos + 1) * sizeof(struct fsearch_item));
+    if (c->stack != c->inlineStack)
+        free(c->stack);
+    c->stack = stack;
+    c->size *= 2;
+}
+
+// Returns TRUE if it found something else, FALSE if not
+int fxytree_cursor_next(FXYCURSOR *c, FXYITEM **ptr)
+{
+    struct fsearch_item *tos;
+    double sx1 = c->sx1;
+    double sy1 = c->sy1;
+    double sx2 = c->sx2;
+    double sy2 = c->sy2;
+
+    while (c->tos >= 0)
+    {
+        tos = &c->stack[c->tos];
+
+        // It is a tree
+        if (!tos->is_list)
+        {
+            int s;
+            FXYTREE_PVT *t = (FXYTREE_PVT *)(tos->addr);
+
+            c->tos--;
+            if (DISJOINT(sx1, sy1, sx2, sy2, t)) // check search area against
+                continue;                        // bbox of stuff in tree
+
+            // room for the three children
+            if (c->tos + 3 >= c->size)
+                fxycursor_grow(c);
+            tos = &c->stack[c->tos];
+
+            FINDSIDE(t, sx1, sy1, sx2, sy2, s);
+            if (s == LEFT)
+            {
+                ADD_ITEM(tos, t->ptr[MIDDLE].al, t->is_list[MIDDLE]);
+                ADD_ITEM(tos, t->ptr[LEFT].al, t->is_list[LEFT]);
+            }
+            else if (s == RIGHT)
+            {
+                ADD_ITEM(tos, t->ptr[MIDDLE].al, t->is_list[MIDDLE]);
+                ADD_ITEM(tos, t->ptr[RIGHT].al, t->is_list[RIGHT]);
+            }
+            else
+            {
+                ADD_ITEM(tos, t->ptr[LEFT].al, t->is_list[LEFT]);
+                ADD_ITEM(tos, t->ptr[RIGHT].al, t->is_list[RIGHT]);
+                ADD_ITEM(tos, t->ptr[MIDDLE].al, t->is_list[MIDDLE]);
+            }
+            c->tos = (int)(tos - c->stack);
+        }
+        else // item is a list search it for OK values
+        {
+            FXYITEM *l;
+            for (l = (FXYITEM *)(tos->addr); l != NULL; l = l->next)
+            {
+                if (!DISJOINT(sx1, sy1, sx2, sy2, l))
+                {
+                    *ptr = l;
+                    tos->addr = (oslong)(l->next);
+                    return TRUE;
+                }
+            }
+            // Nothing in this list. decrement stack and try again
+            c->tos--;
+        }
+    }
+    return FALSE;
+}
+
+void fxytree_cursor_done(FXYCURSOR *c)
+{
+    if (c->stack != c->inlineStack)
+        free(c->stack);
+    c->stack = c->inlineStack;
+    c->size = FXYCURSOR_INLINE_DEPTH;
+    c->tos = -1;
+}
+
+/**
+ * @brief Call FN for every item overlapping the search area until it
+ * returns TRUE.
+ *
+ * @return int TRUE if FN stopped the search
+ */
+int fxytree_visit(const FXYTREE *tl, double x1, double y1, double x2, double y2,
+                  FXYVISITFN fn, void *arg)
+{
+    FXYCURSOR c;
+    FXYITEM *item;
+    int stopped = FALSE;
+
+    fxytree_cursor_init(&c, tl, x1, y1, x2, y2);
+    while (fxytree_cursor_next(&c, &item))
+    {
+        if ((*fn)(item, arg))
+        {
+            stopped = TRUE;
+            break;
+        }
+    }
+    fxytree_cursor_done(&c);
+    return stopped;
+}
+
+// Visit everything below the frozen child index CHILD. Recursion depth is
+// the tree depth.
+static int fxyfrozen_visit_node(const FXYFROZEN *fr, unsigned int child,
+                                double sx1, double sy1, double sx2, double sy2,
+                                FXYVISITFN fn, void *arg)
+{
+    const FXYFROZEN_NODE *t;
+    int s;
+
+    if (child == FXYFROZEN_EMPTY)
+        return FALSE;
+
+    if (child & FXYFROZEN_LEAF)
+    {
+        const FXYFROZEN_LEAF_RANGE *lr = &fr->leaves[child & ~FXYFROZEN_LEAF];
+        unsigned int i = lr->first;
+        unsigned int end = lr->first + lr->count;
+        unsigned int n;
+        unsigned int mask;
+
+        for (; i < end; i += n)
+        {
+            n = end - i;
+            if (n > FXY_SCAN_BLOCK)
+                n = FXY_SCAN_BLOCK;
+            mask = fxy_overlap_mask(fr->bx1 + i, fr->by1 + i, fr->bx2 + i, fr->by2 + i,
+                                    n, sx1, sy1, sx2, sy2);
+            for (; mask; mask &= mask - 1)
+            {
+                if ((*fn)(&fr->items[i + fxy_ctz(mask)], arg))
+                    return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    t = &fr->nodes[child];
+    if (DISJOINT(sx1, sy1, sx2, sy2, t))
+        return FALSE;
+
+    FINDSIDE(t, sx1, sy1, sx2, sy2, s);
+    if (fxyfrozen_visit_node(fr, t->child[MIDDLE], sx1, sy1, sx2, sy2, fn, arg))
+        return TRUE;
+    if (s != RIGHT && fxyfrozen_visit_node(fr, t->child[LEFT], sx1, sy1, sx2, sy2, fn, arg))
+        return TRUE;
+    if (s != LEFT && fxyfrozen_visit_node(fr, t->child[RIGHT], sx1, sy1, sx2, sy2, fn, arg))
+        return TRUE;
+    return FALSE;
+}
+
+int fxyfrozen_visit(const FXYFROZEN *fr, double x1, double y1, double x2, double y2,
+                    FXYVISITFN fn, void *arg)
+{
+    FIXFORDER(x1, x2);
+    FIXFORDER(y1, y2);
+    return fxyfrozen_visit_node(fr, 0, x1, y1, x2, y2, fn, arg);
+}
+
+// Count nodes and leaves, and sum item sizes into *w and *h.
+static void fxytree_stats_walk(const FXYTREE_PVT *t, int depth, FXYSTATS *st, double *w, double *h)
+{
+    FXYITEM *l;
+    int i;
+    int n;
+
+    st->nodes++;
+    if (depth > st->depth)
+        st->depth = depth;
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (!t->is_list[i])
+        {
+            fxytree_stats_walk(t->ptr[i].xy, depth + 1, st, w, h);
+            continue;
+        }
+        n = 0;
+        for (l = t->ptr[i].al; l != NULL; l = l->next)
+        {
+            n++;
+            *w += l->x2 - l->x1;
+            *h += l->y2 - l->y1;
+        }
+        if (n == 0)
+            continue;
+        st->leaves++;
+        st->items += n;
+        if (n > st->maxLeaf)
+            st->maxLeaf = n;
+        if (i == MIDDLE)
+        {
+            st->middleItems += n;
+            if (n > st->maxMiddle)
+                st->maxMiddle = n;
+        }
+    }
+}
+
+/**
+ * @brief Expected nodes plus items looked at below T by a QW x QH search,
+ * relative to the root, whose box grown by the search size has area AREA.
+ * A search reaches a node when it overlaps the node's box, and then scans
+ * all of the node's lists.
+ */
+static double fxytree_cost_walk(const FXYTREE_PVT *t, double qw, double qh, double area)
+{
+    double p;
+    double cost;
+    FXYITEM *l;
+    int i;
+    int n = 0;
+
+    if (t->x1 > t->x2)
+        return 0.0; // empty
+    p = (t->x2 - t->x1 + qw) * (t->y2 - t->y1 + qh) / area;
+    cost = p;
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (!t->is_list[i])
+            cost += fxytree_cost_walk(t->ptr[i].xy, qw, qh, area);
+        else
+        {
+            for (l = t->ptr[i].al; l != NULL; l = l->next)
+                n++;
+        }
+    }
+    return cost + p * n;
+}
+
+/**
+ * @brief Report the shape of the tree TL in *STATS.
+ *
+ * @param tl
+ * @param stats
+ */
+void fxytree_stats(const FXYTREE *tl, FXYSTATS *stats)
+{
+    const FXYTREE_PVT *root = tl->fxyTreePvt;
+    double w = 0.0;
+    double h = 0.0;
+    double area;
+
+    memset(stats, 0, sizeof(FXYSTATS));
+    fxytree_stats_walk(root, 1, stats, &w, &h);
+    if (stats->leaves)
+        stats->meanLeaf = (double)stats->items / stats->leaves;
+    if (stats->items == 0)
+        return;
+
+    w /= stats->items;
+    h /= stats->items;
+    area = (root->x2 - root->x1 + w) * (root->y2 - root->y1 + h);
+    if (area > 0.0)
+        stats->expectedCost = fxytree_cost_walk(root, w, h, area);
+    else
+        stats->expectedCost = stats->nodes + stats->items; // all points on one spot
+}
+
+/*
+    Join helpers. Two slots only need to be looked at if their boxes, one
+    grown by the join distance, overlap.
+*/
+#define FXYJOIN_APART(e, a, b) \
+    ((a)->x2 + (e) < (b)->x1 || (a)->x1 - (e) > (b)->x2 || (a)->y2 + (e) < (b)->y1 || (a)->y1 - (e) > (b)->y2)
+
+// Slot of list address LIST in the box table of CTX: its entry, or the free one it would go in.
+static FXYJOINBOX *fxyjoin_box_slot(FXYJOINCTX *ctx, oslong list)
+{
+    unsigned long long h = (unsigned long long)list * 0x9E3779B97F4A7C15ULL;
+    int i = (int)(h >> 40) & (ctx->size - 1);
+
+    while (ctx->boxes[i].list != 0 && ctx->boxes[i].list != list)
+        i = (i + 1) & (ctx->size - 1);
+    return &ctx->boxes[i];
+}
+
+// Keep the box of a list in CTX, growing the table to stay at most half full.
+static void fxyjoin_box_put(FXYJOINCTX *ctx, const FXYJOINSLOT *s)
+{
+    FXYJOINBOX *b;
+    int i;
+
+    if (2 * (ctx->nBoxes + 1) > ctx->size)
+    {
+        FXYJOINBOX *old = ctx->boxes;
+        int oldSize = ctx->size;
+
+        ctx->size = oldSize ? 2 * oldSize : 64;
+        ctx->boxes = (FXYJOINBOX *)calloc(ctx->size, sizeof(FXYJOINBOX));
+        for (i = 0; i < oldSize; i++)
+        {
+            if (old[i].list != 0)
+                *fxyjoin_box_slot(ctx, old[i].list) = old[i];
+        }
+        free(old);
+    }
+    b = fxyjoin_box_slot(ctx, s->addr);
+    b->list = s->addr;
+    b->x1 = s->x1;
+    b->y1 = s->y1;
+    b->x2 = s->x2;
+    b->y2 = s->y2;
+    ctx->nBoxes++;
+}
+
+/*
+    Fill in the bounding box of a slot. A node has its box; a list is
+    scanned the first time the join meets it and its box kept in CTX, as
+    one list is met again for every slot of the other tree that comes near
+    its node. Empty lists get an inverted box.
+*/
+static void fxyslot_bbox(FXYJOINCTX *ctx, FXYJOINSLOT *s)
+{
+    FXYITEM *l;
+
+    if (!s->is_list)
+    {
+        FXYTREE_PVT *t = (FXYTREE_PVT *)s->addr;
+        s->x1 = t->x1;
+        s->y1 = t->y1;
+        s->x2 = t->x2;
+        s->y2 = t->y2;
+        return;
+    }
+    if (ctx->size)
+    {
+        FXYJOINBOX *b = fxyjoin_box_slot(ctx, s->addr);
+        if (b->list == s->addr)
+        {
+            s->x1 = b->x1;
+            s->y1 = b->y1;
+            s->x2 = b->x2;
+            s->y2 = b->y2;
+            return;
+        }
+    }
+    s->x1 = s->y1 = (double)DBL_MAX;
+    s->x2 = s->y2 = (double)-DBL_MAX;
+    for (l = (FXYITEM *)s->addr; l != NULL; l = l->next)
+    {
+        if (l->x1 < s->x1)
+            s->x1 = l->x1;
+        if (l->x2 > s->x2)
+            s->x2 = l->x2;
+        if (l->y1 < s->y1)
+            s->y1 = l->y1;
+        if (l->y2 > s->y2)
+            s->y2 = l->y2;
+    }
+    fxyjoin_box_put(ctx, s);
+}
+
+/**
+ * @brief Join slot A (from tree A) against slot B (from tree B). Two lists
+ * are compared item by item. Otherwise the node with the bigger box is
+ * opened and each of its children that comes near the other slot is
+ * joined against it.
+ *
+ * @return int TRUE if the callback stopped the join
+ */
+static int fxyjoin_slots(FXYJOINCTX *ctx, FXYJOINSLOT *a, FXYJOINSLOT *b)
+{
+    FXYJOINSLOT child;
+    FXYJOINSLOT *open;
+    FXYJOINSLOT *other;
+    FXYTREE_PVT *t;
+    FXYITEM *la;
+    FXYITEM *lb;
+    double e = ctx->expand;
+    int i;
+
+    if (FXYJOIN_APART(e, a, b))
+        return FALSE;
+
+    if (a->is_list && b->is_list)
+    {
+        for (la = (FXYITEM *)a->addr; la != NULL; la = la->next)
+        {
+            if (FXYJOIN_APART(e, la, b))
+                continue;
+            for (lb = (FXYITEM *)b->addr; lb != NULL; lb = lb->next)
+            {
+                if (!FXYJOIN_APART(e, la, lb) && (*ctx->fn)(la, lb, ctx->arg))
+                    return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    // open a node: the bigger one, or the only one
+    if (b->is_list ||
+        (!a->is_list && (a->x2 - a->x1) + (a->y2 - a->y1) >= (b->x2 - b->x1) + (b->y2 - b->y1)))
+    {
+        open = a;
+        other = b;
+    }
+    else
+    {
+        open = b;
+        other = a;
+    }
+
+    t = (FXYTREE_PVT *)open->addr;
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (t->ptr[i].al == NULL)
+            continue;
+        child.addr = (oslong)t->ptr[i].al;
+        child.is_list = t->is_list[i];
+        fxyslot_bbox(ctx, &child);
+        if (open == a ? fxyjoin_slots(ctx, &child, other) : fxyjoin_slots(ctx, other, &child))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Self join of everything below one slot: each child with itself,
+ * and each pair of children with each other.
+ *
+ * @return int TRUE if the callback stopped the join
+ */
+static int fxyjoin_self_slot(FXYJOINCTX *ctx, FXYJOINSLOT *a)
+{
+    FXYJOINSLOT child[3];
+    FXYTREE_PVT *t;
+    FXYITEM *la;
+    FXYITEM *lb;
+    double e = ctx->expand;
+    int i;
+    int j;
+
+    if (a->is_list)
+    {
+        for (la = (FXYITEM *)a->addr; la != NULL; la = la->next)
+        {
+            for (lb = la->next; lb != NULL; lb = lb->next)
+            {
+                if (!FXYJOIN_APART(e, la, lb) && (*ctx->fn)(la, lb, ctx->arg))
+                    return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    t = (FXYTREE_PVT *)a->addr;
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        child[i].addr = (oslong)t->ptr[i].al;
+        child[i].is_list = t->is_list[i];
+        if (child[i].addr)
+            fxyslot_bbox(ctx, &child[i]);
+    }
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (!child[i].addr)
+            continue;
+        if (fxyjoin_self_slot(ctx, &child[i]))
+            return TRUE;
+        for (j = i + 1; j <= RIGHT; j++)
+        {
+            if (child[j].addr && fxyjoin_slots(ctx, &child[i], &child[j]))
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Call FN for every item of tree A and item of tree B whose boxes
+ * are within EXPAND of each other. Both trees are walked together, so the
+ * descent from the root is shared by all items instead of repeated for
+ * each one.
+ *
+ * @return int TRUE if FN stopped the join
+ */
+int fxytree_join(const FXYTREE *treeA, const FXYTREE *treeB, double expand,
+                 FXYJOINFN fn, void *arg)
+{
+    FXYJOINCTX ctx;
+    FXYJOINSLOT a;
+    FXYJOINSLOT b;
+    int stopped;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.expand = expand;
+    ctx.fn = fn;
+    ctx.arg = arg;
+
+    a.addr = (oslong)treeA->fxyTreePvt;
+    a.is_list = FALSE;
+    fxyslot_bbox(&ctx, &a);
+    b.addr = (oslong)treeB->fxyTreePvt;
+    b.is_list = FALSE;
+    fxyslot_bbox(&ctx, &b);
+
+    stopped = fxyjoin_slots(&ctx, &a, &b);
+    free(ctx.boxes);
+    return stopped;
+}
+
+/**
+ * @brief Call FN once for every unordered pair of distinct items of TREE
+ * whose boxes are within EXPAND of each other.
+ *
+ * @return int TRUE if FN stopped the join
+ */
+int fxytree_self_join(const FXYTREE *tree, double expand,
+                      FXYJOINFN fn, void *arg)
+{
+    FXYJOINCTX ctx;
+    FXYJOINSLOT a;
+    int stopped;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.expand = expand;
+    ctx.fn = fn;
+    ctx.arg = arg;
+
+    a.addr = (oslong)tree->fxyTreePvt;
+    a.is_list = FALSE;
+    stopped = fxyjoin_self_slot(&ctx, &a);
+    free(ctx.boxes);
+    return stopped;
+}
+
+// squared distance from the query box to a box
+static double fxynear_d2(const FXYNEAR *q, double x1, double y1, double x2, double y2)
+{
+    double dx = 0.0;
+    double dy = 0.0;
+
+    if (x1 > q->qx2)
+        dx = x1 - q->qx2;
+    else if (q->qx1 > x2)
+        dx = q->qx1 - x2;
+    if (y1 > q->qy2)
+        dy = y1 - q->qy2;
+    else if (q->qy1 > y2)
+        dy = q->qy1 - y2;
+    return dx * dx + dy * dy;
+}
+
+// push onto the min-heap, growing it as needed
+static void fxynear_push(FXYNEAR *q, double d2, oslong addr, int kind)
+{
+    FXYNEAR_ENTRY e;
+    int i;
+
+    if (q->n == q->size)
+    {
+        q->size = q->size ? 2 * q->size : 64;
+        q->heap = (FXYNEAR_ENTRY *)realloc(q->heap, q->size * sizeof(FXYNEAR_ENTRY));
+        ASSERT(q->heap);
+    }
+    e.d2 = d2;
+    e.addr = addr;
+    e.kind = (char)kind;
+    for (i = q->n++; i > 0 && q->heap[(i - 1) / 2].d2 > d2; i = (i - 1) / 2)
+        q->heap[i] = q->heap[(i - 1) / 2];
+    q->heap[i] = e;
+}
+
+static void fxynear_start(FXYNEAR *q, const FXYTREE *tree,
+                          double x1, double y1, double x2, double y2)
+{
+    FXYTREE_PVT *t = tree->fxyTreePvt;
+
+    FIXFORDER(x1, x2);
+    FIXFORDER(y1, y2);
+    q->qx1 = x1;
+    q->qy1 = y1;
+    q->qx2 = x2;
+    q->qy2 = y2;
+    q->heap = NULL;
+    q->n = q->size = 0;
+    if (t && t->x1 <= t->x2)
+        fxynear_push(q, fxynear_d2(q, t->x1, t->y1, t->x2, t->y2), (oslong)t, FXYNEAR_NODE);
+}
+
+/**
+ * @brief Return the next nearest item whose squared distance is at most
+ * LIMIT2, or NULL when there is none. Nodes and lists popped on the way
+ * are opened and their contents queued.
+ */
+static FXYITEM *fxynear_next(FXYNEAR *q, double limit2, double *d2)
+{
+    FXYNEAR_ENTRY e;
+    FXYNEAR_ENTRY last;
+    FXYTREE_PVT *t;
+    FXYITEM *l;
+    int i;
+    int c;
+
+    while (q->n > 0 && q->heap[0].d2 <= limit2)
+    {
+        e = q->heap[0];
+        last = q->heap[--q->n];
+        for (i = 0; (c = 2 * i + 1) < q->n; i = c)
+        {
+            if (c + 1 < q->n && q->heap[c + 1].d2 < q->heap[c].d2)
+                c++;
+            if (last.d2 <= q->heap[c].d2)
+                break;
+            q->heap[i] = q->heap[c];
+        }
+        if (q->n > 0)
+            q->heap[i] = last;
+
+        switch (e.kind)
+        {
+        case FXYNEAR_ITEM:
+            *d2 = e.d2;
+            return (FXYITEM *)e.addr;
+        case FXYNEAR_LIST:
+            for (l = (FXYITEM *)e.addr; l != NULL; l = l->next)
+                fxynear_push(q, fxynear_d2(q, l->x1, l->y1, l->x2, l->y2), (oslong)l, FXYNEAR_ITEM);
+            break;
+        default:
+            t = (FXYTREE_PVT *)e.addr;
+            for (i = LEFT; i <= RIGHT; i++)
+            {
+                if (t->ptr[i].al == NULL)
+                    continue;
+                if (t->is_list[i])
+                    fxynear_push(q, e.d2, (oslong)t->ptr[i].al, FXYNEAR_LIST);
+                else
+                {
+                    FXYTREE_PVT *s = t->ptr[i].xy;
+                    fxynear_push(q, fxynear_d2(q, s->x1, s->y1, s->x2, s->y2), (oslong)s, FXYNEAR_NODE);
+                }
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the K items nearest to point (PX, PY).
+ *
+ * @param items receives the items, nearest first
+ * @param dists receives their distances, may be NULL
+ * @return int number of items found (less than K if the tree is smaller)
+ */
+int fxytree_knn(const FXYTREE *tree, double px, double py, int k,
+                FXYITEM **items, double *dists)
+{
+    FXYNEAR q;
+    FXYITEM *l;
+    double d2;
+    int n = 0;
+
+    if (k <= 0)
+        return 0;
+    fxynear_start(&q, tree, px, py, px, py);
+    // HUGE_VAL, so items whose squared distance overflows to inf still come back
+    while (n < k && (l = fxynear_next(&q, HUGE_VAL, &d2)) != NULL)
+    {
+        items[n] = l;
+        if (dists)
+            dists[n] = sqrt(d2);
+        n++;
+    }
+    free(q.heap);
+    return n;
+}
+
+/**
+ * @brief Find every item within DIST of the box X1, Y1, X2, Y2.
+ *
+ * @param items set to a malloc'ed array of the items, nearest first
+ * @param dists set to a malloc'ed array of their distances, may be NULL
+ * @return int number of items found
+ */
+int fxytree_within(const FXYTREE *tree, double x1, double y1, double x2, double y2,
+                   double dist, FXYITEM ***items, double **dists)
+{
+    FXYNEAR q;
+    FXYITEM *l;
+    FXYITEM **out = NULL;
+    double *outd = NULL;
+    double d2;
+    int n = 0;
+    int size = 0;
+
+    fxynear_start(&q, tree, x1, y1, x2, y2);
+    if (dist >= 0.0)
+    {
+        while ((l = fxynear_next(&q, dist * dist, &d2)) != NULL)
+        {
+            if (n == size)
+            {
+                size = size ? 2 * size : 16;
+                out = (FXYITEM **)realloc(out, size * sizeof(FXYITEM *));
+                ASSERT(out);
+                if (dists)
+                {
+                    outd = (double *)realloc(outd, size * sizeof(double));
+                    ASSERT(outd);
+                }
+            }
+            out[n] = l;
+            if (dists)
+                outd[n] = sqrt(d2);
+            n++;
+        }
+    }
+    free(q.heap);
+    *items = out;
+    if (dists)
+        *dists = outd;
+    return n;
+}
+
+// Spread the low 16 bits of V to the even bits of the result.
+static unsigned int fxy_morton_spread(unsigned int v)
+{
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// qsort order of batch boxes: Morton key, then caller order
+static int fxybatch_key_cmp(const void *a, const void *b)
+{
+    const FXYBATCHBOX *ba = (const FXYBATCHBOX *)a;
+    const FXYBATCHBOX *bb = (const FXYBATCHBOX *)b;
+
+    if (ba->key != bb->key)
+        return ba->key < bb->key ? -1 : 1;
+    return ba->index - bb->index;
+}
+
+static void fxybatch_hit(FXYBATCH *b, int index, FXYITEM *item)
+{
+    if (b->nHits == b->size)
+    {
+        b->size = b->size ? 2 * b->size : 256;
+        b->hits = (FXYBATCHHIT *)realloc(b->hits, b->size * sizeof(FXYBATCHHIT));
+        ASSERT(b->hits);
+    }
+    b->hits[b->nHits].index = index;
+    b->hits[b->nHits].item = item;
+    b->nHits++;
+}
+
+// Test every item of list L against the group boxes in MASK.
+static void fxybatch_list(FXYBATCH *b, FXYITEM *l, unsigned int mask)
+{
+    for (; l != NULL; l = l->next)
+    {
+        unsigned int m = mask;
+        while (m)
+        {
+            int i = fxy_ctz(m);
+            const FXYBATCHBOX *q = &b->group[i];
+
+            m &= m - 1;
+            if (!DISJOINT(q->x1, q->y1, q->x2, q->y2, l))
+                fxybatch_hit(b, q->index, l);
+        }
+    }
+}
+
+/**
+ * @brief Search the subtree T for the group boxes in MASK. Each box goes
+ * to the children FINDSIDE sends it to, so one descent serves every box
+ * that needs it. Recursion depth is the tree depth.
+ */
+static void fxybatch_node(FXYBATCH *b, const FXYTREE_PVT *t, unsigned int mask)
+{
+    unsigned int m = mask;
+    unsigned int side[3];
+    int i;
+
+    side[LEFT] = side[MIDDLE] = side[RIGHT] = 0;
+    while (m)
+    {
+        const FXYBATCHBOX *q;
+        int s;
+
+        i = fxy_ctz(m);
+        m &= m - 1;
+        q = &b->group[i];
+        if (DISJOINT(q->x1, q->y1, q->x2, q->y2, t))
+            continue;
+        FINDSIDE(t, q->x1, q->y1, q->x2, q->y2, s);
+        side[MIDDLE] |= 1u << i;
+        if (s != RIGHT)
+            side[LEFT] |= 1u << i;
+        if (s != LEFT)
+            side[RIGHT] |= 1u << i;
+    }
+
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (!side[i] || t->ptr[i].al == NULL)
+            continue;
+        if (t->is_list[i])
+            fxybatch_list(b, t->ptr[i].al, side[i]);
+        else
+            fxybatch_node(b, t->ptr[i].xy, side[i]);
+    }
+}
+
+/**
+ * @brief Search TREE for each of the N BOXES. The boxes are put in Morton
+ * order of their centers so that each group of FXY_BATCH_GROUP walks down
+ * the tree together, and the hits are returned in CSR form: those of
+ * boxes[i] are (*items)[offsets[i]] .. (*items)[offsets[i + 1] - 1].
+ *
+ * @param offsets caller supplied, N + 1 entries
+ * @param items set to a malloc'ed array of all hits, NULL if none
+ * @return int total number of hits
+ */
+int fxytree_query_batch(const FXYTREE *tree, const FXYQUERYBOX *boxes, int n,
+                        int *offsets, FXYITEM ***items)
+{
+    const FXYTREE_PVT *root = tree->fxyTreePvt;
+    FXYBATCHBOX *sorted;
+    FXYBATCH b;
+    FXYITEM **out = NULL;
+    double sx;
+    double sy;
+    int i;
+
+    *items = NULL;
+    if (n <= 0)
+    {
+        if (n == 0)
+            offsets[0] = 0;
+        return 0;
+    }
+
+    // quantize box centers to 16 bits over the tree's bounding box
+    sx = root->x2 > root->x1 ? 65535.0 / (root->x2 - root->x1) : 0.0;
+    sy = root->y2 > root->y1 ? 65535.0 / (root->y2 - root->y1) : 0.0;
+
+    sorted = (FXYBATCHBOX *)malloc(n * sizeof(FXYBATCHBOX));
+    ASSERT(sorted);
+    for (i = 0; i < n; i++)
+    {
+        FXYBATCHBOX *q = &sorted[i];
+        double cx;
+        double cy;
+
+        q->x1 = boxes[i].x1;
+        q->y1 = boxes[i].y1;
+        q->x2 = boxes[i].x2;
+        q->y2 = boxes[i].y2;
+        FIXFORDER(q->x1, q->x2);
+        FIXFORDER(q->y1, q->y2);
+        q->index = i;
+
+        cx = ((q->x1 + q->x2) / 2 - root->x1) * sx;
+        cy = ((q->y1 + q->y2) / 2 - root->y1) * sy;
+        // clamp before the conversion; !(c >= 0) also sends NaN to 0
+        cx = !(cx >= 0.0) ? 0.0 : (cx > 65535.0 ? 65535.0 : cx);
+        cy = !(cy >= 0.0) ? 0.0 : (cy > 65535.0 ? 65535.0 : cy);
+        q->key = fxy_morton_spread((unsigned int)cx) | (fxy_morton_spread((unsigned int)cy) << 1);
+    }
+    qsort(sorted, n, sizeof(FXYBATCHBOX), fxybatch_key_cmp);
+
+    b.hits = NULL;
+    b.nHits = 0;
+    b.size = 0;
+    for (i = 0; i < n; i += FXY_BATCH_GROUP)
+    {
+        int k = n - i < FXY_BATCH_GROUP ? n - i : FXY_BATCH_GROUP;
+
+        b.group = &sorted[i];
+        fxybatch_node(&b, root, k == FXY_BATCH_GROUP ? 0xffffffffu : (1u << k) - 1);
+    }
+    free(sorted);
+
+    // bucket the hits per box; a stable pass keeps tree order within a box
+    memset(offsets, 0, (n + 1) * sizeof(int));
+    for (i = 0; i < b.nHits; i++)
+        offsets[b.hits[i].index + 1]++;
+    for (i = 0; i < n; i++)
+        offsets[i + 1] += offsets[i];
+    if (b.nHits)
+    {
+        int *fill = (int *)malloc(n * sizeof(int));
+
+        ASSERT(fill);
+        memcpy(fill, offsets, n * sizeof(int));
+        out = (FXYITEM **)malloc(b.nHits * sizeof(FXYITEM *));
+        ASSERT(out);
+        for (i = 0; i < b.nHits; i++)
+            out[fill[b.hits[i].index]++] = b.hits[i].item;
+        free(fill);
+    }
+    free(b.hits);
+
+    *items = out;
+    return offsets[n];
+}
+
 #ifdef OSASSERT
 #define PBL(n)                  \
     {                           \
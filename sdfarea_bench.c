@@ -0,0 +1,354 @@
+/**
+ * @file sdfarea_bench.c
+ * @author Radica
+ * @brief Stand-alone benchmark of the FXYTREE package (sdfarea.c) on
+ *        synthetic PCB-like data.
+ * @version 0.1
+ * @date 2024-07-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+/*
+    Build it as its own program next to the area package, e.g.
+
+        cc -std=c99 -O2 -c sdfarea_bench.c sdfarea.c
+        c++ -std=c++17 -O2 -o sdfarea_bench sdfarea_bench.o sdfarea.o \
+            sdfarea_par.cxx <SY_Chunk library> -ltbb -lm
+
+    and run
+
+        sdfarea_bench [items [queries [seed]]]
+
+    For each distribution it prints one line: build time of register_farea
+    + rebalance_fxytree, of rebalance_fxytree_parallel on the same items
+    and of build_fxytree_bulk, search throughput through
+    DB_get_next_fxyitem, the frozen tree and the cursor, unregister_farea
+    time, tree memory per item (whole chunk pages, as fxytree_mem_stats
+    reports them), depth, MIDDLE occupancy and the expected cost from
+    fxytree_stats. Every search variant must report the same number of
+    hits and the parallel rebuild must give the very tree the serial one
+    gives; a mismatch is printed as an error and makes the exit status 1.
+
+    The distributions:
+        vias     uniform small squares over the board
+        bga      dense pad grids at a few places, the rest empty
+        clines   long thin horizontal, vertical and diagonal segments
+        voids    nested squares of widely varying size around a few centers
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "SDarea.h"
+#include "SDfarea.h"
+
+#define BOARD 1000000.0 // board side, in database units
+
+typedef struct bench_query
+{
+    double x1, y1, x2, y2;
+} BENCH_QUERY;
+
+typedef void (*BENCH_GEN)(FXYBULKITEM *items, int n);
+
+static double bench_rand(void)
+{
+    return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+static void bench_box(FXYBULKITEM *a, double x, double y, double w, double h, int i)
+{
+    a->x1 = x;
+    a->y1 = y;
+    a->x2 = x + w;
+    a->y2 = y + h;
+    a->ud1 = i;
+    a->ud2 = 0;
+}
+
+static void gen_vias(FXYBULKITEM *items, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        bench_box(&items[i], bench_rand() * BOARD, bench_rand() * BOARD, 20.0, 20.0, i);
+}
+
+static void gen_bga(FXYBULKITEM *items, int n)
+{
+    double pitch = 40.0;
+    double ox = 0.0;
+    double oy = 0.0;
+    int side = 32; // pads per row of one package
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        int k = i % (side * side);
+        if (k == 0)
+        {
+            ox = bench_rand() * (BOARD - side * pitch);
+            oy = bench_rand() * (BOARD - side * pitch);
+        }
+        bench_box(&items[i], ox + (k % side) * pitch, oy + (k / side) * pitch, 20.0, 20.0, i);
+    }
+}
+
+static void gen_clines(FXYBULKITEM *items, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        double x = bench_rand() * BOARD;
+        double y = bench_rand() * BOARD;
+        double len = 500.0 + bench_rand() * 49500.0;
+
+        switch (i % 3)
+        {
+        case 0:
+            bench_box(&items[i], x, y, len, 5.0, i);
+            break;
+        case 1:
+            bench_box(&items[i], x, y, 5.0, len, i);
+            break;
+        default:
+            bench_box(&items[i], x, y, len * 0.7, len * 0.7, i); // diagonal: its box
+            break;
+        }
+    }
+}
+
+static void gen_voids(FXYBULKITEM *items, int n)
+{
+    double cx[16];
+    double cy[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        cx[i] = bench_rand() * BOARD;
+        cy[i] = bench_rand() * BOARD;
+    }
+    for (i = 0; i < n; i++)
+    {
+        int c = rand() % 16;
+        double size = 10.0 * pow(5.0e4, bench_rand()); // 10 .. 500000, log uniform
+        double dx = (bench_rand() - 0.5) * size * 0.1;
+        double dy = (bench_rand() - 0.5) * size * 0.1;
+
+        bench_box(&items[i], cx[c] + dx - size / 2, cy[c] + dy - size / 2, size, size, i);
+    }
+}
+
+/**
+ * @brief TRUE if A and B have the same shape, the same splits and boxes,
+ * and the same items in the same order in every list.
+ */
+static int bench_same_tree(const FXYTREE_PVT *a, const FXYTREE_PVT *b)
+{
+    const FXYITEM *p;
+    const FXYITEM *q;
+    int i;
+
+    if (a->xsplit != b->xsplit || a->coord != b->coord ||
+        a->x1 != b->x1 || a->y1 != b->y1 || a->x2 != b->x2 || a->y2 != b->y2)
+        return FALSE;
+    for (i = LEFT; i <= RIGHT; i++)
+    {
+        if (a->is_list[i] != b->is_list[i])
+            return FALSE;
+        if (!a->is_list[i])
+        {
+            if (!bench_same_tree(a->ptr[i].xy, b->ptr[i].xy))
+                return FALSE;
+            continue;
+        }
+        for (p = a->ptr[i].al, q = b->ptr[i].al; p && q; p = p->next, q = q->next)
+        {
+            if (p->ud1 != q->ud1 || p->ud2 != q->ud2)
+                return FALSE;
+        }
+        if (p || q)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static double bench_secs(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static int bench_count(FXYITEM *item, void *arg)
+{
+    (void)item; // only the number of hits is measured
+    (*(long *)arg)++;
+    return FALSE;
+}
+
+/**
+ * @brief Run all measurements on one distribution.
+ *
+ * @return int number of result mismatches
+ */
+static int bench_run(const char *name, BENCH_GEN gen, int n, int nq)
+{
+    FXYBULKITEM *items = (FXYBULKITEM *)malloc(n * sizeof(FXYBULKITEM));
+    BENCH_QUERY *qs = (BENCH_QUERY *)malloc(nq * sizeof(BENCH_QUERY));
+    FXYTREE *tree;
+    FXYTREE *par;
+    FXYTREE *bulk;
+    FXYFROZEN *fr;
+    FXYSTATS st;
+    FXYMEMSTATS ms;
+    FXYCURSOR c;
+    FXYITEM *it;
+    void *h;
+    clock_t t0;
+    double tReg, tPar, tBulk, tQuery, tFrozen, tCursor, tUnreg;
+    long hits, hitsFrozen, hitsCursor;
+    int bad = 0;
+    int i;
+
+    gen(items, n);
+    for (i = 0; i < nq; i++)
+    {
+        // searches of an item's size plus a spacing, near existing items
+        const FXYBULKITEM *a = &items[rand() % n];
+        double r = 50.0 + bench_rand() * 200.0;
+        qs[i].x1 = a->x1 - r;
+        qs[i].y1 = a->y1 - r;
+        qs[i].x2 = a->x1 + r;
+        qs[i].y2 = a->y1 + r;
+    }
+
+    t0 = clock();
+    tree = make_fxytree(0.0);
+    for (i = 0; i < n; i++)
+        register_farea(tree, items[i].x1, items[i].y1, items[i].x2, items[i].y2, items[i].ud1, items[i].ud2);
+    rebalance_fxytree(&tree);
+    tReg = bench_secs(t0);
+
+    par = make_fxytree(0.0);
+    for (i = 0; i < n; i++)
+        register_farea(par, items[i].x1, items[i].y1, items[i].x2, items[i].y2, items[i].ud1, items[i].ud2);
+    t0 = clock();
+    rebalance_fxytree_parallel(&par);
+    tPar = bench_secs(t0);
+    if (!bench_same_tree(tree->fxyTreePvt, par->fxyTreePvt))
+    {
+        fprintf(stderr, "%s: rebalance_fxytree_parallel built another tree\n", name);
+        bad++;
+    }
+    free_fxytree(par);
+
+    t0 = clock();
+    bulk = build_fxytree_bulk(items, n);
+    tBulk = bench_secs(t0);
+    free_fxytree(bulk);
+
+    hits = 0;
+    t0 = clock();
+    for (i = 0; i < nq; i++)
+    {
+        h = DB_set_fxytree_search_box(tree, qs[i].x1, qs[i].y1, qs[i].x2, qs[i].y2);
+        while (DB_get_next_fxyitem(h, &it))
+            hits++;
+        DB_free_fxytree_search_box(h);
+    }
+    tQuery = bench_secs(t0);
+
+    fr = freeze_fxytree(tree);
+    hitsFrozen = 0;
+    t0 = clock();
+    for (i = 0; i < nq; i++)
+        fxyfrozen_visit(fr, qs[i].x1, qs[i].y1, qs[i].x2, qs[i].y2, bench_count, &hitsFrozen);
+    tFrozen = bench_secs(t0);
+    free_fxyfrozen(fr);
+
+    hitsCursor = 0;
+    t0 = clock();
+    for (i = 0; i < nq; i++)
+    {
+        fxytree_cursor_init(&c, tree, qs[i].x1, qs[i].y1, qs[i].x2, qs[i].y2);
+        while (fxytree_cursor_next(&c, &it))
+            hitsCursor++;
+        fxytree_cursor_done(&c);
+    }
+    tCursor = bench_secs(t0);
+
+    if (hitsFrozen != hits || hitsCursor != hits)
+    {
+        fprintf(stderr, "%s: hit counts differ: search %ld frozen %ld cursor %ld\n",
+                name, hits, hitsFrozen, hitsCursor);
+        bad++;
+    }
+
+    fxytree_stats(tree, &st);
+    fxytree_mem_stats(tree, &ms);
+
+    // every other item, so the tree keeps its shape while it shrinks
+    t0 = clock();
+    for (i = 0; i < n; i += 2)
+    {
+        if (!unregister_farea(tree, items[i].x1, items[i].y1, items[i].x2, items[i].y2, items[i].ud1, items[i].ud2))
+        {
+            fprintf(stderr, "%s: item %d not found by unregister_farea\n", name, i);
+            bad++;
+            break;
+        }
+    }
+    tUnreg = bench_secs(t0);
+    free_fxytree(tree);
+
+    printf("%-7s %8.3f %8.3f %8.3f %10.0f %10.0f %10.0f %8.3f %8.1f %5d %7.2f %8.1f %9.1f\n",
+           name, tReg, tPar, tBulk,
+           tQuery > 0.0 ? nq / tQuery : 0.0,
+           tFrozen > 0.0 ? nq / tFrozen : 0.0,
+           tCursor > 0.0 ? nq / tCursor : 0.0,
+           tUnreg,
+           ms.bytes / n,
+           st.depth,
+           st.items ? 100.0 * st.middleItems / st.items : 0.0,
+           (double)hits / nq,
+           st.expectedCost);
+
+    free(qs);
+    free(items);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 200000;
+    int nq = argc > 2 ? atoi(argv[2]) : 100000;
+    unsigned int seed = argc > 3 ? (unsigned int)atoi(argv[3]) : 1;
+    int bad = 0;
+
+    if (n < 1 || nq < 1)
+    {
+        fprintf(stderr, "usage: %s [items [queries [seed]]]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%d items, %d searches, seed %u\n", n, nq, seed);
+    printf("%-7s %8s %8s %8s %10s %10s %10s %8s %8s %5s %7s %8s %9s\n",
+           "dist", "build_s", "par_s", "bulk_s", "search/s", "frozen/s", "cursor/s",
+           "unreg_s", "B/item", "depth", "mid_%", "hits/q", "exp_cost");
+
+    srand(seed);
+    bad += bench_run("vias", gen_vias, n, nq);
+    srand(seed);
+    bad += bench_run("bga", gen_bga, n, nq);
+    srand(seed);
+    bad += bench_run("clines", gen_clines, n, nq);
+    srand(seed);
+    bad += bench_run("voids", gen_voids, n, nq);
+
+    return bad ? 1 : 0;
+}
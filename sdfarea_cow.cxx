@@ -0,0 +1,400 @@
+/**
+ * @file sdfarea_cow.cxx
+ * @author Radica
+ * @brief Copy-on-write, versioned FXYTREE: one writer, any number of
+ *        readers holding immutable snapshots.
+ * @version 0.1
+ * @date 2024-07-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "osassert.h"
+#include "SDarea.h"
+#include "SDfarea.h"
+#include "SDfareaP.h"
+
+/*
+    How it works. The writer never changes a node or item a reader might
+    see. register/unregister copy the nodes on the path from the root (and,
+    for unregister, the items ahead of the removed one in its list) and
+    change the copies, so the working version gets a new root while the
+    published ones are untouched. Everything made since the last commit is
+    "fresh": no reader can see it yet, so it is changed in place.
+
+    fxyvtree_commit() publishes the working version. Each published version
+    keeps a reference count of snapshots on it, and the list of nodes and
+    items that the next version stopped using. Those are reachable only from
+    that version and older ones, so once the oldest versions have no
+    snapshots left their lists are freed, oldest first.
+
+    Nodes and items come in two kinds: those of a balanced base tree made
+    by build_fxytree_bulk (arena memory, freed with the base by
+    free_fxytree), and single copies made here with malloc.
+*/
+struct fxysnapshot
+{
+    FXYTREE view; // what readers search; only fxyTreePvt is set
+    FXYVTREE *owner;
+    int refs;
+    std::vector<FXYTREE_PVT *> deadNodes;
+    std::vector<FXYITEM *> deadItems;
+    std::vector<FXYTREE *> deadBases;
+};
+
+struct fxyvtree
+{
+    std::mutex lock; // guards versions and the refs of each one
+    std::deque<FXYSNAPSHOT *> versions; // published, oldest first
+    FXYTREE_PVT *root;                  // working version
+    FXYTREE *base;                      // base tree the working version uses
+    std::unordered_set<const void *> fresh;
+    std::unordered_set<const FXYITEM *> heapItems; // malloc'ed items in the working version
+    std::vector<FXYTREE_PVT *> deadNodes;          // retired since the last commit
+    std::vector<FXYITEM *> deadItems;
+    std::vector<FXYTREE *> deadBases;
+};
+
+// Free the retired lists of versions nobody can see any more.
+static void fxyvtree_reclaim(FXYVTREE *vt)
+{
+    while (vt->versions.size() > 1 && vt->versions.front()->refs == 0)
+    {
+        FXYSNAPSHOT *v = vt->versions.front();
+        vt->versions.pop_front();
+        for (size_t i = 0; i < v->deadNodes.size(); i++)
+            free(v->deadNodes[i]);
+        for (size_t i = 0; i < v->deadItems.size(); i++)
+            free(v->deadItems[i]);
+        for (size_t i = 0; i < v->deadBases.size(); i++)
+            free_fxytree(v->deadBases[i]);
+        delete v;
+    }
+}
+
+// Node T leaves the working version: free it if fresh, else retire it.
+static void fxyvtree_drop_node(FXYVTREE *vt, FXYTREE_PVT *t)
+{
+    if (fxy_node_is_pooled(t))
+        return; // goes with its base
+    if (vt->fresh.erase(t))
+        free(t);
+    else
+        vt->deadNodes.push_back(t);
+}
+
+static void fxyvtree_drop_item(FXYVTREE *vt, FXYITEM *a)
+{
+    if (!vt->heapItems.erase(a))
+        return; // goes with its base
+    if (vt->fresh.erase(a))
+        free(a);
+    else
+        vt->deadItems.push_back(a);
+}
+
+// Return a node of the working version that may be changed in place of T.
+static FXYTREE_PVT *fxyvtree_own_node(FXYVTREE *vt, FXYTREE_PVT *t)
+{
+    FXYTREE_PVT *c;
+
+    if (vt->fresh.count(t))
+        return t;
+    c = fxy_copy_node(t);
+    fxyvtree_drop_node(vt, t);
+    vt->fresh.insert(c);
+    return c;
+}
+
+static FXYITEM *fxyvtree_new_item(FXYVTREE *vt, const FXYITEM *from)
+{
+    FXYITEM *a = (FXYITEM *)malloc(sizeof(FXYITEM));
+
+    ASSERT(a);
+    *a = *from;
+    vt->fresh.insert(a);
+    vt->heapItems.insert(a);
+    return a;
+}
+
+// Drop every node and item of the subtree T from the working version.
+static void fxyvtree_drop_subtree(FXYVTREE *vt, FXYTREE_PVT *t)
+{
+    FXYITEM *l;
+    FXYITEM *next;
+
+    for (int i = LEFT; i <= RIGHT; i++)
+    {
+        if (!t->is_list[i])
+        {
+            fxyvtree_drop_subtree(vt, t->ptr[i].xy);
+            continue;
+        }
+        for (l = t->ptr[i].al; l != NULL; l = next)
+        {
+            next = l->next;
+            fxyvtree_drop_item(vt, l);
+        }
+    }
+    fxyvtree_drop_node(vt, t);
+}
+
+/**
+ * @brief Make an empty versioned tree. Version 0, the empty tree, is
+ * already published.
+ *
+ * @return FXYVTREE*
+ */
+FXYVTREE *make_fxyvtree(void)
+{
+    FXYVTREE *vt = new FXYVTREE;
+
+    vt->root = make_fxytree_pvt((double)0.0);
+    vt->base = NULL;
+    vt->fresh.insert(vt->root);
+    fxyvtree_commit(vt);
+    return vt;
+}
+
+/**
+ * @brief Free the tree and every version of it. All snapshots must have
+ * been released.
+ *
+ * @param vt
+ */
+void free_fxyvtree(FXYVTREE *vt)
+{
+    FXYSNAPSHOT *cur = vt->versions.back();
+
+    // the current version's lists are the only ones left after this
+    fxyvtree_drop_subtree(vt, vt->root);
+    cur->deadNodes.insert(cur->deadNodes.end(), vt->deadNodes.begin(), vt->deadNodes.end());
+    cur->deadItems.insert(cur->deadItems.end(), vt->deadItems.begin(), vt->deadItems.end());
+    cur->deadBases.insert(cur->deadBases.end(), vt->deadBases.begin(), vt->deadBases.end());
+    if (vt->base)
+        cur->deadBases.push_back(vt->base);
+    vt->versions.push_back(new FXYSNAPSHOT()); // lets the loop take cur too
+    fxyvtree_reclaim(vt);
+    delete vt->versions.back();
+    delete vt;
+}
+
+void fxyvtree_register(FXYVTREE *vt, double x1, double y1, double x2, double y2,
+                       oslong ud1, oslong ud2)
+{
+    FXYTREE_PVT *tree;
+    FXYTREE_PVT **link = &vt->root;
+    FXYITEM proto;
+    FXYITEM *a;
+    int num;
+
+    FIXFORDER(x1, x2);
+    FIXFORDER(y1, y2);
+    proto.next = NULL;
+    proto.x1 = x1;
+    proto.y1 = y1;
+    proto.x2 = x2;
+    proto.y2 = y2;
+    proto.ud1 = ud1;
+    proto.ud2 = ud2;
+
+    for (;;)
+    {
+        tree = *link = fxyvtree_own_node(vt, *link);
+        if (x1 < tree->x1)
+            tree->x1 = x1;
+        if (x2 > tree->x2)
+            tree->x2 = x2;
+        if (y1 < tree->y1)
+            tree->y1 = y1;
+        if (y2 > tree->y2)
+            tree->y2 = y2;
+        FINDSIDE(tree, x1, y1, x2, y2, num);
+        if (tree->is_list[num])
+            break;
+        link = &tree->ptr[num].xy;
+    }
+
+    // the old list is shared as the tail of the new one
+    a = fxyvtree_new_item(vt, &proto);
+    a->next = tree->ptr[num].al;
+    tree->ptr[num].al = a;
+}
+
+/**
+ * @brief Remove an area from the working version. Same rules as
+ * unregister_farea: the area must match exactly.
+ *
+ * @return int TRUE if it was found
+ */
+int fxyvtree_unregister(FXYVTREE *vt, double x1, double y1, double x2, double y2,
+                        oslong ud1, oslong ud2)
+{
+    std::vector<FXYTREE_PVT **> path;
+    FXYTREE_PVT *tree;
+    FXYTREE_PVT **link;
+    FXYITEM **tr;
+    FXYITEM *l;
+    FXYITEM *next;
+    int num;
+
+    FIXFORDER(x1, x2);
+    FIXFORDER(y1, y2);
+
+    // find it first, so nothing is copied for a miss
+    for (tree = vt->root;; tree = tree->ptr[num].xy)
+    {
+        FINDSIDE(tree, x1, y1, x2, y2, num);
+        if (tree->is_list[num])
+            break;
+    }
+    for (l = tree->ptr[num].al; l != NULL; l = l->next)
+    {
+        if (l->x1 == x1 && l->x2 == x2 && l->y1 == y1 && l->y2 == y2 && l->ud1 == ud1 && l->ud2 == ud2)
+            break;
+    }
+    if (l == NULL)
+        return FALSE;
+
+    for (link = &vt->root;; link = &tree->ptr[num].xy)
+    {
+        path.push_back(link);
+        tree = *link = fxyvtree_own_node(vt, *link);
+        FINDSIDE(tree, x1, y1, x2, y2, num);
+        if (tree->is_list[num])
+            break;
+    }
+
+    // copy the items ahead of the match, share the ones after it
+    for (tr = &tree->ptr[num].al; (l = *tr) != NULL; tr = &(*tr)->next)
+    {
+        if (l->x1 == x1 && l->x2 == x2 && l->y1 == y1 && l->y2 == y2 && l->ud1 == ud1 && l->ud2 == ud2)
+        {
+            *tr = l->next;
+            fxyvtree_drop_item(vt, l);
+            break;
+        }
+        if (!vt->fresh.count(l))
+        {
+            next = fxyvtree_new_item(vt, l);
+            fxyvtree_drop_item(vt, l);
+            *tr = next;
+        }
+    }
+
+    while (!path.empty() && adjust_fbb(*path.back()))
+        path.pop_back();
+    return TRUE;
+}
+
+/**
+ * @brief Rebuild the working version as a balanced tree. All of its items
+ * are copied into a new base tree, so published versions keep theirs.
+ *
+ * @param vt
+ */
+void fxyvtree_rebalance(FXYVTREE *vt)
+{
+    std::vector<FXYBULKITEM> items;
+    std::vector<FXYTREE_PVT *> stack(1, vt->root);
+    FXYBULKITEM bi;
+    FXYITEM *l;
+
+    while (!stack.empty())
+    {
+        FXYTREE_PVT *t = stack.back();
+        stack.pop_back();
+        for (int i = LEFT; i <= RIGHT; i++)
+        {
+            if (!t->is_list[i])
+            {
+                stack.push_back(t->ptr[i].xy);
+                continue;
+            }
+            for (l = t->ptr[i].al; l != NULL; l = l->next)
+            {
+                bi.x1 = l->x1;
+                bi.y1 = l->y1;
+                bi.x2 = l->x2;
+                bi.y2 = l->y2;
+                bi.ud1 = l->ud1;
+                bi.ud2 = l->ud2;
+                items.push_back(bi);
+            }
+        }
+    }
+
+    fxyvtree_drop_subtree(vt, vt->root);
+    if (vt->base)
+        vt->deadBases.push_back(vt->base);
+    vt->base = build_fxytree_bulk(items.empty() ? NULL : &items[0], (int)items.size());
+    vt->root = vt->base->fxyTreePvt;
+}
+
+/**
+ * @brief Publish the working version. Snapshots taken from now on see it;
+ * snapshots already taken keep seeing what they saw.
+ *
+ * @param vt
+ */
+void fxyvtree_commit(FXYVTREE *vt)
+{
+    FXYSNAPSHOT *v = new FXYSNAPSHOT();
+
+    v->view.fxyTreePvt = vt->root;
+    v->owner = vt;
+    v->refs = 0;
+
+    std::lock_guard<std::mutex> guard(vt->lock);
+    if (!vt->versions.empty())
+    {
+        // what this commit stopped using is still seen by the last version
+        FXYSNAPSHOT *last = vt->versions.back();
+        last->deadNodes.swap(vt->deadNodes);
+        last->deadItems.swap(vt->deadItems);
+        last->deadBases.swap(vt->deadBases);
+    }
+    vt->deadNodes.clear();
+    vt->deadItems.clear();
+    vt->deadBases.clear();
+    vt->fresh.clear();
+    vt->versions.push_back(v);
+    fxyvtree_reclaim(vt);
+}
+
+/**
+ * @brief Take a snapshot of the last committed version. It stays valid,
+ * and unchanged, until fxysnapshot_release. May be called from any thread.
+ *
+ * @param vt
+ * @return FXYSNAPSHOT*
+ */
+FXYSNAPSHOT *fxyvtree_snapshot(FXYVTREE *vt)
+{
+    std::lock_guard<std::mutex> guard(vt->lock);
+    FXYSNAPSHOT *v = vt->versions.back();
+    v->refs++;
+    return v;
+}
+
+void fxysnapshot_release(FXYSNAPSHOT *snap)
+{
+    FXYVTREE *vt = snap->owner;
+
+    std::lock_guard<std::mutex> guard(vt->lock);
+    snap->refs--;
+    fxyvtree_reclaim(vt);
+}
+
+// The snapshot as a read-only FXYTREE, for the search functions.
+const FXYTREE *fxysnapshot_tree(const FXYSNAPSHOT *snap)
+{
+    return &snap->view;
+}
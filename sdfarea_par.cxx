@@ -0,0 +1,118 @@
+/**
+ * @file sdfarea_par.cxx
+ * @author Radica
+ * @brief Multi-threaded rebalance of large FXYTREEs.
+ * @version 0.1
+ * @date 2024-07-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <mutex>
+#include <vector>
+
+#include <tbb/task_group.h>
+
+#include "SDarea.h"
+#include "SDfarea.h"
+#include "SDfareaP.h"
+
+/*
+    Subtrees with fewer items than this are built serially; below it the
+    cost of a task is no longer small next to the work.
+*/
+#define FXY_PARALLEL_ITEMS 8192
+
+/*
+    Node arenas handed out to the tasks of one rebuild. Each task allocates
+    its nodes from its own arena, so no task ever waits on another; the
+    arenas are adopted by the tree when the build is over.
+*/
+struct FxyParallelBuild
+{
+    std::mutex lock;
+    std::vector<FXYTREE *> arenas;
+
+    FXYTREE *newArena()
+    {
+        FXYTREE *arena = fxy_node_arena_make();
+        std::lock_guard<std::mutex> guard(lock);
+        arenas.push_back(arena);
+        return arena;
+    }
+};
+
+/**
+ * @brief rebalance_fxytree_guts, with the subtrees of big nodes built by
+ * parallel tasks. N is the number of items in LL. The split of every node
+ * is made by fxy_split_list exactly as in the serial build, so the
+ * resulting tree is the same.
+ */
+static solong fxy_parallel_guts(FxyParallelBuild &pb, FXYTREE *owner, FXYITEM *ll, int n, char *what)
+{
+    FXYTREE_PVT *b;
+    int sizes[3];
+    tbb::task_group tg;
+
+    if (n < FXY_PARALLEL_ITEMS)
+        return rebalance_fxytree_guts(owner, ll, what);
+
+    b = fxy_split_list(owner, ll, &n, sizes);
+    if (b == NULL)
+    {
+        *what = TRUE;
+        return (oslong)ll;
+    }
+
+    // LEFT and MIDDLE go to other threads, RIGHT stays on this one
+    for (int i = LEFT; i < RIGHT; i++)
+    {
+        FXYTREE *arena = pb.newArena();
+        tg.run([&pb, arena, b, i, &sizes]
+               { b->ptr[i].xy = (FXYTREE_PVT *)fxy_parallel_guts(pb, arena, b->ptr[i].al, sizes[i], &(b->is_list[i])); });
+    }
+    b->ptr[RIGHT].xy = (FXYTREE_PVT *)fxy_parallel_guts(pb, owner, b->ptr[RIGHT].al, sizes[RIGHT], &(b->is_list[RIGHT]));
+    tg.wait();
+
+    fxynode_set_built(b, n);
+    *what = FALSE;
+    return (oslong)b;
+}
+
+/**
+ * @brief Same as rebalance_fxytree, with the subtrees of big nodes built
+ * in parallel. Builds exactly the tree rebalance_fxytree would; small
+ * trees are simply built serially.
+ *
+ * @param b
+ */
+void rebalance_fxytree_parallel(FXYTREE **b)
+{
+    FXYTREE *tl = *b;
+    FXYTREE *owner;
+    FxyParallelBuild pb;
+    FXYITEM *ll;
+    FXYITEM *l;
+    solong temp;
+    char what;
+    int n = 0;
+
+    // the task arenas can only be handed to a tree with node memory
+    if (fxytree_owner(tl) == NULL)
+    {
+        rebalance_fxytree(b);
+        return;
+    }
+
+    ll = fxytree_unbuild(tl, &owner);
+    for (l = ll; l != NULL; l = l->next)
+        n++;
+
+    temp = fxy_parallel_guts(pb, owner, ll, n, &what);
+    for (size_t i = 0; i < pb.arenas.size(); i++)
+        fxy_node_arena_adopt(owner, pb.arenas[i]);
+
+    tl->fxyTreePvt = fxy_root_from_subtree(owner, temp, what);
+    fxy_rechunk_items(tl);
+}